@@ -0,0 +1,184 @@
+#include "ArcFitter.h"
+#include <math.h>
+
+using namespace std;
+
+/** Minimal number of linear moves replaced by an arc */
+static const int MinArcMoves = 3;
+/** Maximal radius of an arc in mm, above the path is considered as a straight line */
+static const double MaxArcRadius = 1000.0;
+/** Maximal relative variation of the extrusion rate along an arc */
+static const double MaxRateVariation = 0.05;
+
+/** Circle through three points
+ *
+ * @return false if the points are aligned
+ */
+static bool Cercle(double x1,double y1,double x2,double y2,double x3,double y3,
+        double& xc,double& yc,double& r)
+{
+    double bx = x2 - x1, by = y2 - y1;
+    double cx = x3 - x1, cy = y3 - y1;
+    double d = 2.0 * (bx * cy - by * cx);
+    if (fabs(d) < 1e-12)
+        return false;
+    double b2 = bx*bx + by*by;
+    double c2 = cx*cx + cy*cy;
+    double ux = (cy * b2 - by * c2) / d;
+    double uy = (bx * c2 - cx * b2) / d;
+    xc = x1 + ux;
+    yc = y1 + uy;
+    r = sqrt(ux*ux + uy*uy);
+    return true;
+}
+
+/** Checks that the moves of the steps a+1 to b can be replaced by an arc
+ *
+ * @param v Steps of the layer
+ * @param a Index of the step before the first move of the arc
+ * @param b Index of the last move of the arc
+ * @param x0,y0 Start position of the arc, the last position written before step a+1
+ * @param tolerance Maximal distance to the arc
+ * @param xc,yc Center of the arc
+ * @param bCCW True if the arc is counter-clockwise
+ */
+static bool Arc(const vector<GCodeStep>& v,int a,int b,double x0,double y0,double tolerance,
+        double& xc,double& yc,bool& bCCW)
+{
+    int m = (a + b) / 2;
+    double r;
+    if (!Cercle(x0,y0,v[m].m_X,v[m].m_Y,v[b].m_X,v[b].m_Y,xc,yc,r))
+        return false;
+    if (r > MaxArcRadius || r < tolerance)
+        return false;
+    double cross = (v[m].m_X - x0) * (v[b].m_Y - v[m].m_Y) - (v[m].m_Y - y0) * (v[b].m_X - v[m].m_X);
+    bCCW = cross > 0;
+    double length = 0;
+    double sweep = 0;
+    vector<double> vLength(b-a);
+    for (int i=a+1;i<=b;i++)
+    {
+        double x1 = i > a+1 ? v[i-1].m_X : x0, y1 = i > a+1 ? v[i-1].m_Y : y0;
+        double x2 = v[i].m_X, y2 = v[i].m_Y;
+        // Point and middle of the segment at most at the tolerance of the circle
+        if (fabs(sqrt((x2-xc)*(x2-xc) + (y2-yc)*(y2-yc)) - r) > tolerance)
+            return false;
+        double xm = (x1 + x2) / 2.0, ym = (y1 + y2) / 2.0;
+        if (fabs(sqrt((xm-xc)*(xm-xc) + (ym-yc)*(ym-yc)) - r) > tolerance)
+            return false;
+        // Every segment must turn in the direction of the arc
+        double angle = atan2((x1-xc)*(y2-yc) - (y1-yc)*(x2-xc),(x1-xc)*(x2-xc) + (y1-yc)*(y2-yc));
+        if (bCCW ? angle <= 0 : angle >= 0)
+            return false;
+        sweep += fabs(angle);
+        vLength[i-a-1] = sqrt((x2-x1)*(x2-x1) + (y2-y1)*(y2-y1));
+        length += vLength[i-a-1];
+    }
+    if (sweep >= 2.0 * M_PI || length <= 0)
+        return false;
+    // Extrusion evenly distributed along the arc
+    double rate = (v[b].m_E - v[a].m_E) / length;
+    for (int i=a+1;i<=b;i++)
+    {
+        double l = vLength[i-a-1];
+        if (fabs((v[i].m_E - v[i-1].m_E) - rate * l) > MaxRateVariation * rate * l)
+            return false;
+    }
+    return true;
+}
+
+/** Checks if step i may continue a run of moves starting after step a */
+static bool Continue(const vector<GCodeStep>& v,int a,int i)
+{
+    const GCodeStep& s = v[i];
+    if (s.m_Step != GC_MoveLin || s.m_E <= v[i-1].m_E || s.m_Z != v[a].m_Z)
+        return false;
+    // The speed is modal, it can change only on the first move
+    if (i > a+1 && s.m_F != v[i-1].m_F)
+        return false;
+    // Only the last move of an arc may have a comment
+    if (i > a+1 && v[i-1].m_Comment.size())
+        return false;
+    return true;
+}
+
+/** True if the step writes a position */
+static bool Position(const GCodeStep& s)
+{
+    return s.m_Step == GC_MoveFast || s.m_Step == GC_MoveLin || s.m_Step == GC_DefinePos
+        || s.m_Step == GC_ArcCW || s.m_Step == GC_ArcCCW;
+}
+
+int ArcFitting(vector<GCodeStep>& v,double tolerance)
+{
+    bool bPos = false;
+    double x0 = 0, y0 = 0;
+    return ArcFitting(v,tolerance,bPos,x0,y0);
+}
+
+int ArcFitting(vector<GCodeStep>& v,double tolerance,bool& bPos,double& x0,double& y0)
+{
+    vector<GCodeStep> vOut;
+    vOut.reserve(v.size());
+    int nRemoved = 0;
+    int sz = v.size();
+    int a = 0;
+    /*
+     * The start position of a move is the last position written:
+     * Processing may change the position of steps which don't write it
+     */
+    if (sz)
+    {
+        vOut.push_back(v[0]);
+        if (Position(v[0]))
+        {
+            bPos = true;
+            x0 = v[0].m_X;
+            y0 = v[0].m_Y;
+        }
+    }
+    while (a+1 < sz)
+    {
+        /*
+         * The longest run starting after step a which fits an arc
+         */
+        int bBest = -1;
+        double xcBest = 0, ycBest = 0;
+        bool bCCWBest = false;
+        for (int b=a+1;bPos && b<sz && Continue(v,a,b);b++)
+        {
+            if (b - a < MinArcMoves)
+                continue;
+            double xc,yc;
+            bool bCCW;
+            if (!Arc(v,a,b,x0,y0,tolerance,xc,yc,bCCW))
+                break;
+            bBest = b;
+            xcBest = xc;
+            ycBest = yc;
+            bCCWBest = bCCW;
+        }
+        if (bBest < 0)
+        {
+            vOut.push_back(v[++a]);
+        }
+        else
+        {
+            GCodeStep arc = v[bBest];
+            arc.m_Step = bCCWBest ? GC_ArcCCW : GC_ArcCW;
+            arc.m_I = floor((xcBest - x0)*1000.0 + 0.5)/1000.0;
+            arc.m_J = floor((ycBest - y0)*1000.0 + 0.5)/1000.0;
+            vOut.push_back(arc);
+            nRemoved += bBest - a - 1;
+            a = bBest;
+        }
+        if (Position(vOut.back()))
+        {
+            bPos = true;
+            x0 = vOut.back().m_X;
+            y0 = vOut.back().m_Y;
+        }
+    }
+    v.swap(vOut);
+    return nRemoved;
+}
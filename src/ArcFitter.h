@@ -0,0 +1,36 @@
+#ifndef _ARCFITTER_H
+#define _ARCFITTER_H
+
+/** @file */
+
+#include <vector>
+#include "GCodeStep.h"
+
+/** Replaces runs of linear extrusion moves by arcs (G2/G3)
+ *
+ * A run of at least three consecutive extrusion moves is replaced by a single arc
+ * if all its points, and the middles of its segments, are at most at the tolerance
+ * of the arc. The extrusion rate must be the same along the whole run, so that
+ * the extrusion of the arc is evenly distributed along its length.
+ *
+ * @param v G-Code steps of the current layer, after processing
+ * @param tolerance Maximal distance between the arc and the initial path, in mm
+ * @return Number of removed g-code steps
+ */
+int ArcFitting(std::vector<GCodeStep>& v,double tolerance);
+
+/** Replaces runs of linear extrusion moves by arcs, in a part of a layer
+ *
+ * The steps of a layer may be given in several parts, ending before the start of a sequence,
+ * with the same result as the whole layer.
+ *
+ * @param v G-Code steps of the part of the layer
+ * @param tolerance Maximal distance between the arc and the initial path, in mm
+ * @param bPos True if a position was written before the steps, false at the start of a layer.
+ * Updated with the last position written.
+ * @param x0,y0 Last position written before the steps, updated with the last position written
+ * @return Number of removed g-code steps
+ */
+int ArcFitting(std::vector<GCodeStep>& v,double tolerance,bool& bPos,double& x0,double& y0);
+
+#endif
@@ -0,0 +1,461 @@
+#include "AsyncOutput.h"
+#include <stdexcept>
+#include <string>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+using namespace std;
+
+/** Size of a serialization buffer */
+static const size_t BufferSize = 1 << 20;
+/** Number of registered buffers */
+static const int PoolBuffers = 8;
+/** Maximal number of buffers written at the same time on a regular file */
+static const int QueueDepth = 4;
+
+/** @brief Serialization buffer */
+struct AsyncBuffer
+{
+    char *m_pData;
+    /** Number of serialized bytes */
+    size_t m_nSize;
+    /** Number of written bytes */
+    size_t m_nDone;
+    /** Offset of the buffer in the file, or -1 for the current position */
+    long long m_Offset;
+    /** Index of the registered buffer, or -1 for a temporary buffer */
+    int m_nIndex;
+    /** Memory of a temporary buffer */
+    unique_ptr<char[]> m_pOwned;
+
+    AsyncBuffer(char *pData,int nIndex) :
+        m_pData(pData),
+        m_nSize(0),
+        m_nDone(0),
+        m_Offset(-1),
+        m_nIndex(nIndex) {}
+};
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+/** @brief Minimal io_uring submission and completion rings, with the raw system calls */
+class AsyncRing
+{
+    public:
+        AsyncRing() :
+            m_Fd(-1),
+            m_pSq(MAP_FAILED),
+            m_pCq(MAP_FAILED),
+            m_pSqes(MAP_FAILED),
+            m_bFixed(false),
+            m_bFixedSupported(false),
+            m_nPending(0) {}
+        ~AsyncRing()
+        {
+            // Closing the ring waits for the writes in flight
+            if (m_Fd >= 0)
+                close(m_Fd);
+            if (m_pSqes != MAP_FAILED)
+                munmap(m_pSqes,m_Params.sq_entries * sizeof(io_uring_sqe));
+            if (m_pCq != MAP_FAILED)
+                munmap(m_pCq,m_nCqSize);
+            if (m_pSq != MAP_FAILED)
+                munmap(m_pSq,m_nSqSize);
+        }
+        /** Creates the rings
+         *
+         * @return false if io_uring is not available
+         */
+        bool Init(unsigned nEntries)
+        {
+            memset(&m_Params,0,sizeof(m_Params));
+            m_Fd = syscall(__NR_io_uring_setup,nEntries,&m_Params);
+            if (m_Fd < 0)
+                return false;
+            m_nSqSize = m_Params.sq_off.array + m_Params.sq_entries * sizeof(unsigned);
+            m_nCqSize = m_Params.cq_off.cqes + m_Params.cq_entries * sizeof(io_uring_cqe);
+            m_pSq = mmap(0,m_nSqSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,m_Fd,IORING_OFF_SQ_RING);
+            m_pCq = mmap(0,m_nCqSize,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,m_Fd,IORING_OFF_CQ_RING);
+            m_pSqes = mmap(0,m_Params.sq_entries * sizeof(io_uring_sqe),PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE,m_Fd,IORING_OFF_SQES);
+            return m_pSq != MAP_FAILED && m_pCq != MAP_FAILED && m_pSqes != MAP_FAILED && Probe();
+        }
+        /** Registers the pool of buffers, which are then written without mapping them for each write */
+        void Register(char *pData,int nBuffers,size_t size)
+        {
+            vector<iovec> v(nBuffers);
+            for (int i=0;i<nBuffers;i++)
+            {
+                v[i].iov_base = pData + i * size;
+                v[i].iov_len = size;
+            }
+            m_bFixed = m_bFixedSupported && syscall(__NR_io_uring_register,m_Fd,IORING_REGISTER_BUFFERS,v.data(),nBuffers) == 0;
+        }
+        /** Queues the write of the remaining part of a buffer */
+        void Write(int fd,AsyncBuffer *b)
+        {
+            unsigned *pTail = Sq(m_Params.sq_off.tail);
+            unsigned tail = *pTail;
+            unsigned idx = tail & *Sq(m_Params.sq_off.ring_mask);
+            io_uring_sqe *sqe = (io_uring_sqe *)m_pSqes + idx;
+            memset(sqe,0,sizeof(*sqe));
+            sqe->opcode = m_bFixed && b->m_nIndex >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            sqe->fd = fd;
+            sqe->addr = (uintptr_t)(b->m_pData + b->m_nDone);
+            sqe->len = b->m_nSize - b->m_nDone;
+            sqe->off = b->m_Offset < 0 ? (uint64_t)-1 : b->m_Offset + b->m_nDone;
+            if (sqe->opcode == IORING_OP_WRITE_FIXED)
+                sqe->buf_index = b->m_nIndex;
+            sqe->user_data = (uintptr_t)b;
+            Sq(m_Params.sq_off.array)[idx] = idx;
+            __atomic_store_n(pTail,tail + 1,__ATOMIC_RELEASE);
+            m_nPending++;
+        }
+        /** Submits the queued writes and waits for at least one completion
+         *
+         * @return false if the system call failed
+         */
+        bool Enter()
+        {
+            int n;
+            do
+                n = syscall(__NR_io_uring_enter,m_Fd,m_nPending,1,IORING_ENTER_GETEVENTS,NULL,0);
+            while (n < 0 && errno == EINTR);
+            if (n < 0)
+                return false;
+            m_nPending -= n;
+            return true;
+        }
+        /** Takes a completed write
+         *
+         * @param b Written buffer
+         * @param res Number of written bytes, or -errno
+         * @return false if there is no completion
+         */
+        bool Completion(AsyncBuffer *&b,int& res)
+        {
+            unsigned *pHead = Cq(m_Params.cq_off.head);
+            unsigned head = *pHead;
+            if (head == __atomic_load_n(Cq(m_Params.cq_off.tail),__ATOMIC_ACQUIRE))
+                return false;
+            io_uring_cqe *cqe = (io_uring_cqe *)((char *)m_pCq + m_Params.cq_off.cqes)
+                + (head & *Cq(m_Params.cq_off.ring_mask));
+            b = (AsyncBuffer *)(uintptr_t)cqe->user_data;
+            res = cqe->res;
+            __atomic_store_n(pHead,head + 1,__ATOMIC_RELEASE);
+            return true;
+        }
+    private:
+        /** Checks that the kernel supports the write operations
+         *
+         * IORING_OP_WRITE only exists from Linux 5.6, the rings can be created by older kernels.
+         * The probe also appeared in Linux 5.6, its failure means that the writes are not supported.
+         */
+        bool Probe()
+        {
+            const int nOps = 256;
+            vector<char> v(sizeof(io_uring_probe) + nOps * sizeof(io_uring_probe_op),0);
+            io_uring_probe *probe = (io_uring_probe *)v.data();
+            if (syscall(__NR_io_uring_register,m_Fd,IORING_REGISTER_PROBE,probe,nOps) < 0)
+                return false;
+            if (!Supported(probe,IORING_OP_WRITE))
+                return false;
+            m_bFixedSupported = Supported(probe,IORING_OP_WRITE_FIXED);
+            return true;
+        }
+        static bool Supported(const io_uring_probe *probe,int op)
+        {
+            return op <= probe->last_op && op < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+        }
+        unsigned *Sq(unsigned offset) { return (unsigned *)((char *)m_pSq + offset); }
+        unsigned *Cq(unsigned offset) { return (unsigned *)((char *)m_pCq + offset); }
+
+        int m_Fd;
+        io_uring_params m_Params;
+        size_t m_nSqSize;
+        size_t m_nCqSize;
+        void *m_pSq;
+        void *m_pCq;
+        void *m_pSqes;
+        bool m_bFixed;
+        /** True if the kernel supports IORING_OP_WRITE_FIXED */
+        bool m_bFixedSupported;
+        /** Number of queued writes not yet submitted */
+        unsigned m_nPending;
+};
+
+#else
+
+/** @brief Stub of the rings where io_uring does not exist, always using write */
+class AsyncRing
+{
+    public:
+        bool Init(unsigned) { return false; }
+        void Register(char *,int,size_t) {}
+        void Write(int,AsyncBuffer *) {}
+        bool Enter() { return false; }
+        bool Completion(AsyncBuffer *&,int&) { return false; }
+};
+
+#endif
+
+AsyncOutput::AsyncOutput(int fd,bool bUring) :
+    m_Fd(fd),
+    m_Offset(-1),
+    m_nDepth(1),
+    m_vPool(PoolBuffers * BufferSize),
+    m_pCurrent(nullptr),
+    m_bStop(false),
+    m_bClosed(false),
+    m_nError(0)
+{
+    /*
+     * Buffers are written at their offset only on a regular file, without append mode.
+     * On other files the order of the writes is the order of the submissions.
+     */
+    struct stat st;
+    int flags = fcntl(fd,F_GETFL);
+    if (fstat(fd,&st) == 0 && S_ISREG(st.st_mode) && flags >= 0 && !(flags & O_APPEND))
+    {
+        m_Offset = lseek(fd,0,SEEK_CUR);
+        if (m_Offset >= 0)
+            m_nDepth = QueueDepth;
+    }
+    for (int i=0;i<PoolBuffers;i++)
+    {
+        m_vBuffers.push_back(unique_ptr<AsyncBuffer>(new AsyncBuffer(&m_vPool[i * BufferSize],i)));
+        m_vFree.push_back(m_vBuffers.back().get());
+    }
+    if (bUring)
+    {
+        m_pRing.reset(new AsyncRing);
+        if (m_pRing->Init(2 * QueueDepth))
+            m_pRing->Register(m_vPool.data(),PoolBuffers,BufferSize);
+        else
+            m_pRing.reset();
+    }
+    NextBuffer();
+    m_Thread = thread(&AsyncOutput::Run,this);
+}
+
+AsyncOutput::~AsyncOutput()
+{
+    try
+    {
+        Close();
+    }
+    catch (...)
+    {
+    }
+}
+
+void AsyncOutput::NextBuffer()
+{
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        if (m_vFree.size())
+        {
+            m_pCurrent = m_vFree.back();
+            m_vFree.pop_back();
+        }
+    }
+    if (!m_pCurrent)
+    {
+        // The registered buffers are all being written, the serialization does not wait for them
+        m_pCurrent = new AsyncBuffer(nullptr,-1);
+        m_pCurrent->m_pOwned.reset(new char[BufferSize]);
+        m_pCurrent->m_pData = m_pCurrent->m_pOwned.get();
+    }
+    m_pCurrent->m_nSize = 0;
+    m_pCurrent->m_nDone = 0;
+    setp(m_pCurrent->m_pData,m_pCurrent->m_pData + BufferSize);
+}
+
+void AsyncOutput::Queue()
+{
+    m_pCurrent->m_nSize = pptr() - pbase();
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        m_dqQueue.push_back(m_pCurrent);
+    }
+    m_Cond.notify_one();
+    m_pCurrent = nullptr;
+    setp(nullptr,nullptr);
+}
+
+void AsyncOutput::Submit()
+{
+    if (m_bClosed || pptr() == pbase())
+        return;
+    Queue();
+    NextBuffer();
+}
+
+void AsyncOutput::Close()
+{
+    if (m_bClosed)
+        return;
+    m_bClosed = true;
+    Queue();
+    {
+        lock_guard<mutex> lock(m_Mutex);
+        m_bStop = true;
+    }
+    m_Cond.notify_one();
+    m_Thread.join();
+    m_pRing.reset();
+    // The writes at an offset don't move the position of the file
+    if (m_Offset >= 0)
+        lseek(m_Fd,m_Offset,SEEK_SET);
+    if (m_nError)
+        throw runtime_error(string("Unable to write the output: ") + strerror(m_nError));
+}
+
+AsyncOutput::int_type AsyncOutput::overflow(int_type c)
+{
+    if (m_bClosed)
+        return traits_type::eof();
+    Submit();
+    if (!traits_type::eq_int_type(c,traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+streamsize AsyncOutput::xsputn(const char *s,streamsize n)
+{
+    streamsize nWritten = 0;
+    while (nWritten < n)
+    {
+        if (pptr() == epptr() && traits_type::eq_int_type(overflow(traits_type::eof()),traits_type::eof()))
+            break;
+        streamsize sz = min(n - nWritten,(streamsize)(epptr() - pptr()));
+        memcpy(pptr(),s + nWritten,sz);
+        pbump(sz);
+        nWritten += sz;
+    }
+    return nWritten;
+}
+
+int AsyncOutput::sync()
+{
+    // std::endl flushes every line, the buffer is submitted at the end of the layer
+    return 0;
+}
+
+void AsyncOutput::Release(AsyncBuffer *b)
+{
+    if (b->m_nIndex < 0)
+    {
+        delete b;
+        return;
+    }
+    lock_guard<mutex> lock(m_Mutex);
+    m_vFree.push_back(b);
+}
+
+void AsyncOutput::WriteBuffer(AsyncBuffer *b)
+{
+    while (b->m_nDone < b->m_nSize)
+    {
+        ssize_t n = write(m_Fd,b->m_pData + b->m_nDone,b->m_nSize - b->m_nDone);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            m_nError = n < 0 ? errno : EIO;
+            break;
+        }
+        b->m_nDone += n;
+    }
+    Release(b);
+}
+
+void AsyncOutput::Run()
+{
+    int nInFlight = 0;
+    for (;;)
+    {
+        vector<AsyncBuffer*> v;
+        {
+            unique_lock<mutex> lock(m_Mutex);
+            while (m_dqQueue.empty() && !nInFlight && !m_bStop)
+                m_Cond.wait(lock);
+            if (m_dqQueue.empty() && !nInFlight)
+                break;
+            while (m_dqQueue.size() && nInFlight + (int)v.size() < m_nDepth)
+            {
+                v.push_back(m_dqQueue.front());
+                m_dqQueue.pop_front();
+            }
+        }
+        for (auto i = v.begin();i != v.end();i++)
+        {
+            AsyncBuffer *b = *i;
+            b->m_Offset = m_Offset;
+            if (m_Offset >= 0)
+                m_Offset += b->m_nSize;
+            if (m_nError || !b->m_nSize)
+                Release(b);
+            else if (m_pRing)
+            {
+                m_pRing->Write(m_Fd,b);
+                nInFlight++;
+            }
+            else
+                WriteBuffer(b);
+        }
+        if (!nInFlight)
+            continue;
+        if (!m_pRing->Enter())
+        {
+            // The buffers in flight are abandoned, they are released with the ring
+            m_nError = errno;
+            nInFlight = 0;
+            continue;
+        }
+        AsyncBuffer *b;
+        int res;
+        while (m_pRing->Completion(b,res))
+        {
+            nInFlight--;
+            if (res == -EINTR || res == -EAGAIN)
+                res = 0;
+            else if (res <= 0)
+            {
+                if (!m_nError)
+                    m_nError = res < 0 ? -res : EIO;
+                Release(b);
+                continue;
+            }
+            b->m_nDone += res;
+            if (b->m_nDone < b->m_nSize)
+            {
+                // Short write, the rest is written at once
+                m_pRing->Write(m_Fd,b);
+                nInFlight++;
+            }
+            else
+                Release(b);
+        }
+    }
+}
+
+void AsyncOutputSubmit(ostream& os)
+{
+    AsyncOutput *p = dynamic_cast<AsyncOutput *>(os.rdbuf());
+    if (p)
+        p->Submit();
+}
@@ -0,0 +1,100 @@
+#ifndef _ASYNCOUTPUT_H
+#define _ASYNCOUTPUT_H
+
+/** @file */
+
+#include <streambuf>
+#include <ostream>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+struct AsyncBuffer;
+class AsyncRing;
+
+/** @brief Output stream buffer written by a thread, through io_uring when available
+ *
+ * The g-code is serialized in buffers which are submitted at the end of each layer,
+ * or when they are full, to a writer thread.
+ * On a regular file, several buffers are written at the same time at their own offset.
+ * On a pipe or a file opened in append mode, the buffers are written one by one.
+ *
+ * A pool of buffers is registered once with io_uring, and the written buffers are
+ * reused for the serialization of the next layers.
+ * If no buffer of the pool is free, a temporary buffer is allocated,
+ * so that the serialization never waits for the writer thread.
+ * If io_uring or its write operations, from Linux 5.6, are not available, the writer thread uses write.
+ *
+ * Flushing the stream, as done by std::endl, does not submit the buffer.
+ */
+class AsyncOutput : public std::streambuf
+{
+    public:
+        /** Starts the writer thread
+         *
+         * @param fd Output file descriptor, written from its current position
+         * @param bUring Use io_uring if available, otherwise always use write
+         */
+        AsyncOutput(int fd,bool bUring = true);
+        /** Waits for the written data, ignoring the errors */
+        ~AsyncOutput();
+        /** Submits the data serialized in the current buffer */
+        void Submit();
+        /** Writes all the data and stops the writer thread
+         *
+         * @throw std::runtime_error if a write failed
+         */
+        void Close();
+        /** True if the data is written through io_uring */
+        bool Uring() const { return m_pRing != nullptr; }
+    protected:
+        int_type overflow(int_type c);
+        std::streamsize xsputn(const char *s,std::streamsize n);
+        int sync();
+    private:
+        AsyncOutput(const AsyncOutput&);
+        AsyncOutput& operator=(const AsyncOutput&);
+        /** Takes a free buffer for the serialization */
+        void NextBuffer();
+        /** Gives the current buffer to the writer thread */
+        void Queue();
+        /** Writer thread */
+        void Run();
+        /** Writes a buffer with write */
+        void WriteBuffer(AsyncBuffer *b);
+        /** Gives back a written buffer */
+        void Release(AsyncBuffer *b);
+
+        int m_Fd;
+        /** Offset of the next written byte, or -1 if the buffers are written one by one */
+        long long m_Offset;
+        /** Maximal number of buffers written at the same time */
+        int m_nDepth;
+        /** Memory of the registered buffers, released after the ring */
+        std::vector<char> m_vPool;
+        std::vector<std::unique_ptr<AsyncBuffer>> m_vBuffers;
+        std::unique_ptr<AsyncRing> m_pRing;
+        /** Buffer being serialized */
+        AsyncBuffer *m_pCurrent;
+        std::mutex m_Mutex;
+        std::condition_variable m_Cond;
+        /** Buffers submitted and not yet written */
+        std::deque<AsyncBuffer*> m_dqQueue;
+        std::vector<AsyncBuffer*> m_vFree;
+        bool m_bStop;
+        bool m_bClosed;
+        /** errno of the first failed write, 0 if none */
+        int m_nError;
+        std::thread m_Thread;
+};
+
+/** Submits the data written to a stream, if its buffer is an @ref AsyncOutput
+ *
+ * Called at the end of each written layer.
+ */
+void AsyncOutputSubmit(std::ostream& os);
+
+#endif
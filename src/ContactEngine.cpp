@@ -0,0 +1,456 @@
+#include "ContactEngine.h"
+#include "microgeo.h"
+#include "params.h"
+#include <math.h>
+#include <stdint.h>
+#include <deque>
+
+using namespace std;
+
+/** Exact contact detection: the distance to every deposited segment is computed */
+class ExactContactEngine : public ContactEngine
+{
+    public:
+        struct Segment
+        {
+            double x1;
+            double y1;
+            double x2;
+            double y2;
+            Segment() : x1(0),y1(0),x2(0),y2(0) {}
+            Segment(double x1_, double y1_, double x2_, double y2_) : x1(x1_),y1(y1_),x2(x2_),y2(y2_) {}
+        };
+
+        ExactContactEngine(double radius) :
+            m_Radius2(radius*radius) {}
+        virtual void Clear(double xMin,double yMin,double xMax,double yMax);
+        virtual void AddSequence(const vector<pair<double,double>>& v);
+        virtual bool Touches(double x,double y) const;
+    private:
+        double m_Radius2 /** Square of the contact distance */;
+        vector<Segment> m_Deposited /** Segments de plastique de la couche courante */;
+};
+
+void ExactContactEngine::Clear(double xMin,double yMin,double xMax,double yMax)
+{
+    m_Deposited.clear();
+}
+
+void ExactContactEngine::AddSequence(const vector<pair<double,double>>& v)
+{
+    for (int i=0;i+1<v.size();i++)
+        m_Deposited.push_back(Segment(v[i].first,v[i].second,v[i+1].first,v[i+1].second));
+}
+
+bool ExactContactEngine::Touches(double x,double y) const
+{
+    for (auto j=m_Deposited.begin();j!=m_Deposited.end();j++)
+    {
+        if (CarreDistanceSegmentPoint(x,y,j->x1,j->y1,j->x2,j->y2) <= m_Radius2)
+            return true;
+    }
+    return false;
+}
+
+/** Rasterized contact detection
+ *
+ * The deposited segments are drawn in an occupancy bitmap covering the layer:
+ * A cell is set if its center touches a segment. A query is then a single lookup,
+ * and its error is at most half the diagonal of a cell.
+ */
+class RasterContactEngine : public ContactEngine
+{
+    public:
+        RasterContactEngine(double radius,double resolution) :
+            m_Radius(radius),
+            m_Resolution(resolution),
+            m_X0(0),
+            m_Y0(0),
+            m_Nx(0),
+            m_Ny(0) {}
+        virtual void Clear(double xMin,double yMin,double xMax,double yMax);
+        virtual void AddSequence(const vector<pair<double,double>>& v);
+        virtual bool Touches(double x,double y) const;
+    private:
+        double m_Radius /** Contact distance */;
+        double m_Resolution /** Cell size in mm */;
+        double m_X0 /** X position of the corner of the first cell */;
+        double m_Y0 /** Y position of the corner of the first cell */;
+        int m_Nx /** Number of columns */;
+        int m_Ny /** Number of rows */;
+        vector<uint64_t> m_Bits /** Occupancy bitmap, row by row */;
+
+        void AddSegment(double x1,double y1,double x2,double y2);
+};
+
+void RasterContactEngine::Clear(double xMin,double yMin,double xMax,double yMax)
+{
+    /*
+     * Probes are at most at half a wall width from the positions of the layer,
+     * and touching segments at most at the contact distance from the probes:
+     * A margin of one contact distance and one cell is enough for the probes
+     * which are close to the edges of the box.
+     */
+    double margin = 2.0*m_Radius + m_Resolution;
+    m_X0 = xMin - margin;
+    m_Y0 = yMin - margin;
+    m_Nx = (int)ceil((xMax - xMin + 2.0*margin) / m_Resolution) + 1;
+    m_Ny = (int)ceil((yMax - yMin + 2.0*margin) / m_Resolution) + 1;
+    m_Bits.assign(((size_t)m_Nx*m_Ny + 63) / 64,0);
+}
+
+void RasterContactEngine::AddSequence(const vector<pair<double,double>>& v)
+{
+    for (int i=0;i+1<v.size();i++)
+        AddSegment(v[i].first,v[i].second,v[i+1].first,v[i+1].second);
+}
+
+/** Restricts an interval of X positions to the positions where lo <= c*x + k <= hi
+ *
+ * @return false if the interval becomes empty
+ */
+static bool Slab(double c,double k,double lo,double hi,double& xa,double& xb)
+{
+    if (c == 0)
+        return k >= lo && k <= hi;
+    double a = (lo - k) / c;
+    double b = (hi - k) / c;
+    if (c < 0)
+        swap(a,b);
+    xa = max(xa,a);
+    xb = min(xb,b);
+    return xa <= xb;
+}
+
+/** Interval of the X positions of a horizontal line at a distance of at most r from a segment
+ *
+ * The positions at a distance of at most r of a segment form a convex capsule,
+ * union of the disks at the ends and of the band along the segment:
+ * its intersection with the line is the union of their intervals.
+ *
+ * @param yc Y position of the line
+ * @param xa Start of the interval
+ * @param xb End of the interval
+ * @return false if the line doesn't cross the capsule
+ */
+static bool CapsuleRow(double x1,double y1,double x2,double y2,double r,double yc,double& xa,double& xb)
+{
+    bool bFound = false;
+    const double ends[2][2] = { { x1,y1 },{ x2,y2 } };
+    for (int i=0;i<2;i++)
+    {
+        double dy = yc - ends[i][1];
+        double w2 = r*r - dy*dy;
+        if (w2 < 0)
+            continue;
+        double w = sqrt(w2);
+        xa = bFound ? min(xa,ends[i][0] - w) : ends[i][0] - w;
+        xb = bFound ? max(xb,ends[i][0] + w) : ends[i][0] + w;
+        bFound = true;
+    }
+    // Band: projection on the segment between its ends, and distance to its line at most r
+    double dx = x2 - x1;
+    double dy = y2 - y1;
+    double l2 = dx*dx + dy*dy;
+    double a = -INFINITY;
+    double b = INFINITY;
+    double rl = r*sqrt(l2);
+    if (Slab(dx,dy*(yc - y1) - dx*x1,0,l2,a,b) &&
+            Slab(-dy,dx*(yc - y1) + dy*x1,-rl,rl,a,b))
+    {
+        xa = bFound ? min(xa,a) : a;
+        xb = bFound ? max(xb,b) : b;
+        bFound = true;
+    }
+    return bFound;
+}
+
+void RasterContactEngine::AddSegment(double x1,double y1,double x2,double y2)
+{
+    // As for the exact engine, a segment of null length touches nothing
+    if (x1 == x2 && y1 == y2)
+        return;
+    int iyMin = (int)floor((min(y1,y2) - m_Radius - m_Y0) / m_Resolution);
+    int iyMax = (int)floor((max(y1,y2) + m_Radius - m_Y0) / m_Resolution);
+    if (iyMin < 0)
+        iyMin = 0;
+    if (iyMax >= m_Ny)
+        iyMax = m_Ny-1;
+    double r2 = m_Radius*m_Radius;
+    /*
+     * Only the cells of each row crossed by the capsule of the segment are visited.
+     * The centers in the capsule shrunk by a cell are set without test, and
+     * those outside of the capsule grown by a cell are not visited: the distance
+     * is only computed near the edge, with the same result as for every cell.
+     */
+    double rOut = m_Radius + m_Resolution;
+    double rIn = m_Radius - m_Resolution;
+    for (int iy=iyMin;iy<=iyMax;iy++)
+    {
+        double yc = m_Y0 + (iy + 0.5) * m_Resolution;
+        double xa,xb;
+        if (!CapsuleRow(x1,y1,x2,y2,rOut,yc,xa,xb))
+            continue;
+        // Cells whose center is between xa and xb
+        int ixMin = max(0,(int)ceil((xa - m_X0) / m_Resolution - 0.5));
+        int ixMax = min(m_Nx-1,(int)floor((xb - m_X0) / m_Resolution - 0.5));
+        int ixInMin = ixMax + 1;
+        int ixInMax = ixMax;
+        if (rIn > 0 && CapsuleRow(x1,y1,x2,y2,rIn,yc,xa,xb))
+        {
+            ixInMin = (int)ceil((xa - m_X0) / m_Resolution - 0.5);
+            ixInMax = (int)floor((xb - m_X0) / m_Resolution - 0.5);
+        }
+        for (int ix=ixMin;ix<=ixMax;ix++)
+        {
+            double xc = m_X0 + (ix + 0.5) * m_Resolution;
+            if ((ix >= ixInMin && ix <= ixInMax) || CarreDistanceSegmentPoint(xc,yc,x1,y1,x2,y2) <= r2)
+            {
+                size_t n = (size_t)iy*m_Nx + ix;
+                m_Bits[n >> 6] |= (uint64_t)1 << (n & 63);
+            }
+        }
+    }
+}
+
+bool RasterContactEngine::Touches(double x,double y) const
+{
+    double fx = floor((x - m_X0) / m_Resolution);
+    double fy = floor((y - m_Y0) / m_Resolution);
+    // Written to be false for NaN positions, as the exact engine
+    if (!(fx >= 0 && fy >= 0 && fx < m_Nx && fy < m_Ny))
+        return false;
+    size_t n = (size_t)fy*m_Nx + (size_t)fx;
+    return (m_Bits[n >> 6] >> (n & 63)) & 1;
+}
+
+/** Approximate contact detection with the recent deposited material only
+ *
+ * The nozzle usually touches the material of the same sequence or of the previous
+ * few perimeters: only the segments of the last sequences, and of the last part
+ * of the extruded path, are kept. The distance to each of them is computed.
+ */
+class RecentContactEngine : public ContactEngine
+{
+    public:
+        /**
+         * @param radius Contact distance
+         * @param nSequences Number of sequences kept, or 0 for no limit
+         * @param length Length of extruded path kept, or 0 for no limit
+         */
+        RecentContactEngine(double radius,int nSequences,double length) :
+            m_Radius2(radius*radius),
+            m_nMaxSequences(nSequences),
+            m_MaxLength(length),
+            m_nSequences(0),
+            m_Length(0) {}
+        virtual void Clear(double xMin,double yMin,double xMax,double yMax);
+        virtual void AddSequence(const vector<pair<double,double>>& v);
+        virtual bool Touches(double x,double y) const;
+    private:
+        struct Segment : public ExactContactEngine::Segment
+        {
+            double length /** Length of the segment */;
+            bool bLast /** True for the last segment of a sequence */;
+            Segment(double x1_, double y1_, double x2_, double y2_,bool bLast_) :
+                ExactContactEngine::Segment(x1_,y1_,x2_,y2_),
+                length(sqrt((x2_-x1_)*(x2_-x1_) + (y2_-y1_)*(y2_-y1_))),
+                bLast(bLast_) {}
+        };
+        double m_Radius2 /** Square of the contact distance */;
+        int m_nMaxSequences /** Number of sequences kept, or 0 */;
+        double m_MaxLength /** Length of extruded path kept, or 0 */;
+        int m_nSequences /** Number of sequences, even partially, kept */;
+        double m_Length /** Length of the segments kept */;
+        deque<Segment> m_dqDeposited /** Segments kept, the oldest first */;
+};
+
+void RecentContactEngine::Clear(double xMin,double yMin,double xMax,double yMax)
+{
+    m_dqDeposited.clear();
+    m_nSequences = 0;
+    m_Length = 0;
+}
+
+void RecentContactEngine::AddSequence(const vector<pair<double,double>>& v)
+{
+    if (v.size() < 2)
+        return;
+    for (int i=0;i+1<v.size();i++)
+    {
+        m_dqDeposited.push_back(Segment(v[i].first,v[i].second,v[i+1].first,v[i+1].second,i+2 == v.size()));
+        m_Length += m_dqDeposited.back().length;
+    }
+    m_nSequences++;
+    /*
+     * The oldest segments are removed while the limits are exceeded,
+     * the path kept is at least the limit length
+     */
+    while (m_dqDeposited.size())
+    {
+        const Segment& s = m_dqDeposited.front();
+        bool bTooMany = m_nMaxSequences > 0 && m_nSequences > m_nMaxSequences;
+        bool bTooLong = m_MaxLength > 0 && m_Length - s.length >= m_MaxLength;
+        if (!bTooMany && !bTooLong)
+            break;
+        m_Length -= s.length;
+        if (s.bLast)
+            m_nSequences--;
+        m_dqDeposited.pop_front();
+    }
+}
+
+bool RecentContactEngine::Touches(double x,double y) const
+{
+    for (auto j=m_dqDeposited.begin();j!=m_dqDeposited.end();j++)
+    {
+        if (CarreDistanceSegmentPoint(x,y,j->x1,j->y1,j->x2,j->y2) <= m_Radius2)
+            return true;
+    }
+    return false;
+}
+
+/** Contact detection with the segments stored in tiles
+ *
+ * The layer is divided in square tiles. The segments are split to be at most as long
+ * as a tile, and each part is stored in the tile of its middle, its ends being
+ * 16 bits offsets in microns from the corner of the tile: a segment takes 8 bytes instead of 32.
+ * A query only decodes the segments of the tiles whose parts may be at the contact distance.
+ *
+ * The answers are the ones of the exact engine, except for points at the contact distance
+ * of a segment, within the rounding of its ends to the micron.
+ */
+class TiledContactEngine : public ContactEngine
+{
+    public:
+        TiledContactEngine(double radius) :
+            m_Radius(radius),
+            m_X0(0),
+            m_Y0(0),
+            m_Nx(0),
+            m_Ny(0) {}
+        virtual void Clear(double xMin,double yMin,double xMax,double yMax);
+        virtual void AddSequence(const vector<pair<double,double>>& v);
+        virtual bool Touches(double x,double y) const;
+    private:
+        /** Segment, with its ends in microns from the corner of its tile */
+        struct Segment
+        {
+            int16_t x1;
+            int16_t y1;
+            int16_t x2;
+            int16_t y2;
+        };
+        /** Tile size in microns, the ends of a segment part are at most 1.5 tile from the corner */
+        static const int TileSize = 4000;
+        double m_Radius /** Contact distance */;
+        double m_X0 /** X position of the corner of the first tile, at the micron */;
+        double m_Y0 /** Y position of the corner of the first tile, at the micron */;
+        int m_Nx /** Number of columns */;
+        int m_Ny /** Number of rows */;
+        vector<vector<Segment>> m_vTiles /** Segments of each tile, row by row */;
+
+        void AddSegment(double x1,double y1,double x2,double y2);
+        /** Tile of a position, clamped to the grid */
+        int Tile(double v,double v0,int n) const;
+};
+
+void TiledContactEngine::Clear(double xMin,double yMin,double xMax,double yMax)
+{
+    // Same margin as the raster engine, the probes may be outside of the box
+    double margin = 2.0*m_Radius + TileSize / 1000.0;
+    m_X0 = floor((xMin - margin) * 1000.0) / 1000.0;
+    m_Y0 = floor((yMin - margin) * 1000.0) / 1000.0;
+    m_Nx = (int)ceil((xMax + margin - m_X0) * 1000.0 / TileSize) + 1;
+    m_Ny = (int)ceil((yMax + margin - m_Y0) * 1000.0 / TileSize) + 1;
+    // The tiles keep their memory from one layer to the next
+    m_vTiles.resize((size_t)m_Nx*m_Ny);
+    for (auto i = m_vTiles.begin();i != m_vTiles.end();i++)
+        i->clear();
+}
+
+int TiledContactEngine::Tile(double v,double v0,int n) const
+{
+    double f = floor((v - v0) * 1000.0 / TileSize);
+    if (!(f >= 0))
+        return 0;
+    if (f >= n)
+        return n-1;
+    return (int)f;
+}
+
+void TiledContactEngine::AddSequence(const vector<pair<double,double>>& v)
+{
+    for (int i=0;i+1<v.size();i++)
+    {
+        double x1 = v[i].first, y1 = v[i].second;
+        double x2 = v[i+1].first, y2 = v[i+1].second;
+        double length = sqrt((x2-x1)*(x2-x1) + (y2-y1)*(y2-y1));
+        int n = (int)ceil(length * 1000.0 / TileSize);
+        if (n <= 1)
+        {
+            AddSegment(x1,y1,x2,y2);
+            continue;
+        }
+        for (int k=0;k<n;k++)
+        {
+            double t1 = (double)k / n, t2 = (double)(k+1) / n;
+            AddSegment(x1 + (x2-x1)*t1,y1 + (y2-y1)*t1,
+                    k+1 == n ? x2 : x1 + (x2-x1)*t2,k+1 == n ? y2 : y1 + (y2-y1)*t2);
+        }
+    }
+}
+
+void TiledContactEngine::AddSegment(double x1,double y1,double x2,double y2)
+{
+    int ix = Tile((x1 + x2) / 2.0,m_X0,m_Nx);
+    int iy = Tile((y1 + y2) / 2.0,m_Y0,m_Ny);
+    double xt = m_X0 + ix * (TileSize / 1000.0);
+    double yt = m_Y0 + iy * (TileSize / 1000.0);
+    Segment s;
+    s.x1 = (int16_t)floor((x1 - xt) * 1000.0 + 0.5);
+    s.y1 = (int16_t)floor((y1 - yt) * 1000.0 + 0.5);
+    s.x2 = (int16_t)floor((x2 - xt) * 1000.0 + 0.5);
+    s.y2 = (int16_t)floor((y2 - yt) * 1000.0 + 0.5);
+    m_vTiles[(size_t)iy*m_Nx + ix].push_back(s);
+}
+
+bool TiledContactEngine::Touches(double x,double y) const
+{
+    // Written to be false for NaN positions, as the exact engine
+    if (!(x == x && y == y))
+        return false;
+    // The ends of a part are at most half a tile from the middle
+    double reach = m_Radius + TileSize / 2000.0;
+    int ixMin = Tile(x - reach,m_X0,m_Nx), ixMax = Tile(x + reach,m_X0,m_Nx);
+    int iyMin = Tile(y - reach,m_Y0,m_Ny), iyMax = Tile(y + reach,m_Y0,m_Ny);
+    double r2 = m_Radius*m_Radius;
+    for (int iy=iyMin;iy<=iyMax;iy++)
+    {
+        double yt = m_Y0 + iy * (TileSize / 1000.0);
+        for (int ix=ixMin;ix<=ixMax;ix++)
+        {
+            double xt = m_X0 + ix * (TileSize / 1000.0);
+            const vector<Segment>& tile = m_vTiles[(size_t)iy*m_Nx + ix];
+            for (auto j = tile.begin();j != tile.end();j++)
+            {
+                if (CarreDistanceSegmentPoint(x,y,xt + j->x1 / 1000.0,yt + j->y1 / 1000.0,
+                            xt + j->x2 / 1000.0,yt + j->y2 / 1000.0) <= r2)
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+std::unique_ptr<ContactEngine> ContactEngineFactory(const Params& params,bool bExact)
+{
+    double radius = (double)params.nozzleDiameter / 1000.0 / 2.0;
+    if (!bExact && params.contact == CM_Raster)
+        return unique_ptr<ContactEngine>(new RasterContactEngine(radius,(double)params.rasterResolution / 1000.0));
+    if (!bExact && params.contact == CM_Recent)
+        return unique_ptr<ContactEngine>(new RecentContactEngine(radius,params.recentSequences,params.recentLength));
+    if (!bExact && params.contact == CM_Tiled)
+        return unique_ptr<ContactEngine>(new TiledContactEngine(radius));
+    return unique_ptr<ContactEngine>(new ExactContactEngine(radius));
+}
@@ -0,0 +1,42 @@
+#ifndef _CONTACTENGINE_H
+#define _CONTACTENGINE_H
+
+/** @file */
+
+#include <vector>
+#include <memory>
+#include <utility>
+
+/** @brief Contact detection with the material deposited in the current layer
+ *
+ * A point touches the deposited material if it is at most at half the nozzle
+ * diameter of one of the deposited segments.
+ */
+struct ContactEngine
+{
+    /** Virtual destructor to allow polymorphism */
+    virtual ~ContactEngine() {}
+    /** Starts a new layer, without any deposited material
+     *
+     * All the positions of the layer must be inside the bounding box
+     */
+    virtual void Clear(double xMin,double yMin,double xMax,double yMax) = 0;
+    /** Adds the segments of a deposited sequence
+     *
+     * @param v Positions of the sequence, segment i goes from v[i] to v[i+1]
+     */
+    virtual void AddSequence(const std::vector<std::pair<double,double>>& v) = 0;
+    /** True if the point touches deposited material */
+    virtual bool Touches(double x,double y) const = 0;
+};
+
+class Params;
+
+/** Contact detection engine factory
+ *
+ * @param params Global parameters, selecting the engine
+ * @param bExact If true, the exact engine is built whatever the parameters are
+ */
+std::unique_ptr<ContactEngine> ContactEngineFactory(const Params& params,bool bExact = false);
+
+#endif
@@ -0,0 +1,72 @@
+#include "FileCopy.h"
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+/** Size of the buffer of the read and write copy */
+static const size_t CopyBufferSize = 1 << 20;
+
+/** copy_file_range called through syscall, the libc may be older than the kernel */
+static ssize_t CopyFileRangeSyscall(int fdIn,loff_t *offIn,int fdOut,size_t len)
+{
+#ifdef SYS_copy_file_range
+    return syscall(SYS_copy_file_range,fdIn,offIn,fdOut,NULL,len,0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void CopyFileRange(int fdIn,long long offset,long long length,int fdOut)
+{
+    loff_t off = offset;
+    long long end = offset + length;
+    /*
+     * Kernel copy between regular files, possibly sharing the blocks
+     */
+    while (off < end)
+    {
+        ssize_t n = CopyFileRangeSyscall(fdIn,&off,fdOut,end - off);
+        if (n <= 0)
+            break;
+    }
+    /*
+     * Kernel copy to any file descriptor, pipes included
+     */
+    while (off < end)
+    {
+        off_t offSend = off;
+        ssize_t n = sendfile(fdOut,fdIn,&offSend,end - off);
+        if (n <= 0)
+            break;
+        off = offSend;
+    }
+    /*
+     * Copy through user memory
+     */
+    vector<char> buffer(off < end ? CopyBufferSize : 0);
+    while (off < end)
+    {
+        ssize_t n = pread(fdIn,&buffer[0],min<long long>(CopyBufferSize,end - off),off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            throw runtime_error("Unable to read the input file");
+        for (ssize_t w = 0;w < n;)
+        {
+            ssize_t nw = write(fdOut,&buffer[w],n - w);
+            if (nw < 0 && errno == EINTR)
+                continue;
+            if (nw <= 0)
+                throw runtime_error("Unable to write the output file");
+            w += nw;
+        }
+        off += n;
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef _FILECOPY_H
+#define _FILECOPY_H
+
+/** @file */
+
+/** Copies a part of a file to a file descriptor
+ *
+ * The copy is done by the kernel if possible, with copy_file_range between regular files,
+ * then with sendfile, and otherwise with read and write.
+ * The data is written at the current position of the output file descriptor.
+ *
+ * @param fdIn Input file descriptor, of a regular file
+ * @param offset Offset of the first copied byte in the input file
+ * @param length Number of bytes to copy
+ * @param fdOut Output file descriptor
+ * @throw std::runtime_error if the copy fails
+ */
+void CopyFileRange(int fdIn,long long offset,long long length,int fdOut);
+
+#endif
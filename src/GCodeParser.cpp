@@ -6,7 +6,24 @@
 #include <boost/spirit/include/qi.hpp>
 #include <boost/spirit/include/phoenix.hpp>
 #include <iomanip>
+#include <deque>
+#include <memory>
+#include <iterator>
+#include <string.h>
+#include <strings.h>
+#include <limits>
+#include <climits>
+#include <cmath>
+#include <assert.h>
 #include "GCodeStep.h"
+#include "ArcFitter.h"
+#include "Trace.h"
+#include "Patch.h"
+#include "AsyncOutput.h"
+#include "PerfCounters.h"
+#include "StepCache.h"
+#include <fstream>
+#include "params.h"
 
 using namespace std;
 
@@ -53,6 +70,16 @@ struct GCodeWriter
         m_CurE(0),
         m_CurF(0) {}
 
+    /** Sets the parameters as if the step was the last one written */
+    void Reset(const GCodeStep& step)
+    {
+        m_CurX = step.m_X;
+        m_CurY = step.m_Y;
+        m_CurZ = step.m_Z;
+        m_CurE = step.m_E;
+        m_CurF = step.m_F;
+    }
+
     /** Writes G-Code step
      */
     void Write(const GCodeStep& step);
@@ -62,6 +89,11 @@ struct GCodeWriter
      * since the previous g-code step
      */
     void ParamsG0G1(const GCodeStep& step);
+    /** Write positions part of G2 and G3 commands
+     *
+     * The end position and the center of the arc are always printed
+     */
+    void ParamsG2G3(const GCodeStep& step);
 };
 
 void GCodeWriter::ParamsG0G1(const GCodeStep& step)
@@ -79,6 +111,20 @@ void GCodeWriter::ParamsG0G1(const GCodeStep& step)
         cout << " E" << setprecision(10) << step.m_E;
 }
 
+void GCodeWriter::ParamsG2G3(const GCodeStep& step)
+{
+    if (m_CurF != step.m_F)
+        cout << " F" << step.m_F;
+    cout << " X" << step.m_X;
+    cout << " Y" << step.m_Y;
+    if (m_CurZ != step.m_Z)
+        cout << " Z" << step.m_Z;
+    cout << " I" << step.m_I;
+    cout << " J" << step.m_J;
+    if (m_CurE != step.m_E)
+        cout << " E" << setprecision(10) << step.m_E;
+}
+
 void GCodeWriter::Write(const GCodeStep& step)
 {
     switch (step.m_Step)
@@ -107,6 +153,14 @@ void GCodeWriter::Write(const GCodeStep& step)
             cout << "G92";
             ParamsG0G1(step);
             break;
+        case GC_ArcCW:
+            cout << "G2";
+            ParamsG2G3(step);
+            break;
+        case GC_ArcCCW:
+            cout << "G3";
+            ParamsG2G3(step);
+            break;
     }
 
     if (step.m_Comment.size())
@@ -120,6 +174,56 @@ void GCodeWriter::Write(const GCodeStep& step)
     m_CurF = step.m_F;
 }
 
+/** Names of the feature types, several names may have the same type */
+static const struct
+{
+    const char *m_Name;
+    EFeature m_Feature;
+} FeatureNames[] =
+{
+    { "NONE", FT_None },
+    { "WALL-OUTER", FT_WallOuter },
+    { "WALL-INNER", FT_WallInner },
+    { "SKIN", FT_Skin },
+    { "FILL", FT_Fill },
+    { "SKIRT", FT_Skirt },
+    { "SUPPORT", FT_Support },
+    { "SUPPORT-INTERFACE", FT_Support },
+    { "OTHER", FT_Other }
+};
+
+bool GCodeFeature(const string& name,EFeature& feature)
+{
+    for (size_t i=0;i<sizeof(FeatureNames)/sizeof(FeatureNames[0]);i++)
+    {
+        if (strcasecmp(name.c_str(),FeatureNames[i].m_Name) == 0)
+        {
+            feature = FeatureNames[i].m_Feature;
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Sets the feature type of the following steps if the comment is a ;TYPE: comment
+ *
+ * @param step Current step, the type is modal
+ * @param v Comment, without the ';'
+ */
+static void CommentFeature(GCodeStep& step,const vector<char>& v)
+{
+    static const char Prefix[] = "TYPE:";
+    const size_t n = sizeof(Prefix) - 1;
+    if (v.size() < n || memcmp(&v[0],Prefix,n))
+        return;
+    string name(v.begin() + n,v.end());
+    // A Windows line end is removed, but not the spaces of a comment
+    while (name.size() && (name.back() == ' ' || name.back() == '\r'))
+        name.pop_back();
+    if (!GCodeFeature(name,step.m_Feature))
+        step.m_Feature = FT_Other;
+}
+
 /** Temporary object used by @ref gcode_grammar
  * during the parsing of the gcode input file
  */
@@ -132,50 +236,195 @@ struct GCodeFileParser
     /** GCode steps of the current layer */
     vector<GCodeStep> m_vLayerGCode;
     StretchAlgorithm *algo;
+    const Params& m_Params;
     GCodeWriter m_Writer;
+    /** Number of g-code steps removed by the arc fitting */
+    int m_nArcRemoved;
+    /** Trace time of the start of the parsing of the current layer */
+    double m_ParseStart;
+    /** Performance counters at the start of the parsing of the current layer */
+    PerfSample m_PerfParse;
+    /** Number of steps parsed in the current layer */
+    int m_nLayerSteps;
+    /** Steps of the current layer not written yet, in streaming mode */
+    deque<GCodeStep> m_dqStream;
+    /** True if the current layer has steps, in streaming mode */
+    bool m_bStreamLayer;
+    /** If not NULL, the changed positions are written in this patch instead of the g-code */
+    PatchWriter *m_pPatch;
+    /** If not NULL, the parsed steps are recorded in this cache */
+    StepCache *m_pCache;
+    /** Number of lines of the layers before the current one */
+    long long m_nLines;
+    /** True if the position of the last move was changed, in patch mode */
+    bool m_bPatchMoved;
+    /** Last position written in the current layer, for the arc fitting in streaming mode */
+    bool m_bArcPos;
+    double m_ArcX;
+    double m_ArcY;
 
     GCodeFileParser(
-            StretchAlgorithm *algo_) :
-        algo(algo_),
+            StretchAlgorithm *algo_,
+            const Params& params_) :
         m_nLayer(0),
-        m_ZLayer(0) {}
+        m_ZLayer(0),
+        algo(algo_),
+        m_Params(params_),
+        m_nArcRemoved(0),
+        m_ParseStart(TraceEnabled() ? TraceNow() : 0),
+        m_nLayerSteps(0),
+        m_bStreamLayer(false),
+        m_pPatch(NULL),
+        m_pCache(NULL),
+        m_nLines(0),
+        m_bPatchMoved(false),
+        m_bArcPos(false),
+        m_ArcX(0),
+        m_ArcY(0)
+    {
+        if (PerfCountersEnabled())
+            PerfCountersRead(m_PerfParse);
+    }
 
     void Comment(const vector<char>& v);
 
     GCodeStep m_CurrentStep;
 
     void FlushStep();
+    /** Adds a parsed step to the current layer, processing the previous layer if Z changed */
+    void AddStep(GCodeStep&& step);
     void Flush();
+    /** Processes and writes the current layer */
+    void ProcessLayer();
+    /** Records the moves of the current layer changed by the processing
+     *
+     * @param vOrig Positions of the steps before the processing
+     */
+    void WritePatch(const vector<pair<double,double>>& vOrig);
+    /** Writes the first steps of the current layer, in streaming mode
+     *
+     * @param n Number of steps processed by @ref StretchAlgorithm::ProcessStream
+     * @param nLayer Number of the current layer
+     */
+    void WriteStream(size_t n,int nLayer);
 };
 
-void GCodeFileParser::Flush()
+void GCodeFileParser::WriteStream(size_t n,int nLayer)
 {
-    if (m_vLayerGCode.size())
+    if (!n)
+        return;
+    PerfCounterScope counters(PS_Write,n,nLayer);
+    vector<GCodeStep> v(make_move_iterator(m_dqStream.begin()),make_move_iterator(m_dqStream.begin() + n));
+    m_dqStream.erase(m_dqStream.begin(),m_dqStream.begin() + n);
+    if (m_Params.arcTolerance > 0)
+        m_nArcRemoved += ArcFitting(v,(double)m_Params.arcTolerance / 1000.0,m_bArcPos,m_ArcX,m_ArcY);
+    for (auto i = v.begin() ; i != v.end(); i++)
+        m_Writer.Write(*i);
+    AsyncOutputSubmit(cout);
+}
+
+/*
+ * A changed move is recorded with its new position. The next move is also recorded
+ * with its position, written explicitly, because the original line may rely on
+ * the modal position of the changed move.
+ * The positions of the other steps are not written by the writer.
+ */
+void GCodeFileParser::WritePatch(const vector<pair<double,double>>& vOrig)
+{
+    for (int i=0;i<m_vLayerGCode.size();i++)
     {
-        algo->Process(++m_nLayer,m_vLayerGCode);
+        const GCodeStep& step = m_vLayerGCode[i];
+        if (step.m_Step != GC_MoveFast && step.m_Step != GC_MoveLin)
+            continue;
+        bool bMoved = step.m_X != vOrig[i].first || step.m_Y != vOrig[i].second;
+        if (bMoved || m_bPatchMoved)
+            m_pPatch->Record(m_nLines + i + 1,step.m_X,step.m_Y);
+        m_bPatchMoved = bMoved;
+    }
+}
+
+void GCodeFileParser::ProcessLayer()
+{
+    ++m_nLayer;
+    if (PerfCountersEnabled())
+        PerfCountersRecord(PS_Parse,m_PerfParse,m_nLayerSteps,m_nLayer);
+    m_nLayerSteps = 0;
+    if (m_Params.stream)
+    {
+        WriteStream(algo->ProcessStream(m_nLayer,m_dqStream,true),m_nLayer);
+        m_bStreamLayer = false;
+        m_bArcPos = false;
+        return;
+    }
+    if (m_pPatch)
+    {
+        vector<pair<double,double>> vOrig;
+        vOrig.reserve(m_vLayerGCode.size());
+        for (auto i = m_vLayerGCode.begin() ; i != m_vLayerGCode.end(); i++)
+            vOrig.push_back(make_pair(i->m_X,i->m_Y));
+        algo->Process(m_nLayer,m_vLayerGCode);
+        WritePatch(vOrig);
+        m_nLines += m_vLayerGCode.size();
+        return;
+    }
+    if (TraceEnabled())
+        TraceEvent("Parse",m_ParseStart,m_vLayerGCode.size(),m_nLayer);
+    algo->Process(m_nLayer,m_vLayerGCode);
+    if (m_Params.arcTolerance > 0)
+    {
+        TraceSpan span("ArcFitting",m_vLayerGCode.size(),m_nLayer);
+        m_nArcRemoved += ArcFitting(m_vLayerGCode,(double)m_Params.arcTolerance / 1000.0);
+    }
+    {
+        TraceSpan span("Write",m_vLayerGCode.size(),m_nLayer);
+        PerfCounterScope counters(PS_Write,m_vLayerGCode.size(),m_nLayer);
         for (auto i = m_vLayerGCode.begin() ; i != m_vLayerGCode.end(); i++)
+        {
+            assert(i->m_Z == m_vLayerGCode.begin()->m_Z);
             m_Writer.Write(*i);
+        }
+        AsyncOutputSubmit(cout);
     }
+    if (TraceEnabled())
+        m_ParseStart = TraceNow();
 }
 
+void GCodeFileParser::Flush()
+{
+    if (m_vLayerGCode.size() || m_bStreamLayer)
+        ProcessLayer();
+}
 
-void GCodeFileParser::FlushStep()
+
+void GCodeFileParser::AddStep(GCodeStep&& step)
 {
-    if (m_ZLayer != m_CurrentStep.m_Z)
+    if (m_pCache)
+        m_pCache->Record(step);
+    if (m_ZLayer != step.m_Z)
     {
-        if (m_vLayerGCode.size())
+        if (m_vLayerGCode.size() || m_bStreamLayer)
         {
-            algo->Process(++m_nLayer,m_vLayerGCode);
-            for (auto i = m_vLayerGCode.begin() ; i != m_vLayerGCode.end(); i++)
-            {
-                assert(i->m_Z == m_vLayerGCode.begin()->m_Z);
-                m_Writer.Write(*i);
-            }
+            ProcessLayer();
             m_vLayerGCode.clear();
+            if (PerfCountersEnabled())
+                PerfCountersRead(m_PerfParse);
         }
-        m_ZLayer = m_CurrentStep.m_Z;
+        m_ZLayer = step.m_Z;
+    }
+    m_nLayerSteps++;
+    if (m_Params.stream)
+    {
+        m_dqStream.push_back(std::move(step));
+        m_bStreamLayer = true;
+        WriteStream(algo->ProcessStream(m_nLayer + 1,m_dqStream,false),m_nLayer + 1);
     }
-    m_vLayerGCode.push_back(m_CurrentStep);
+    else
+        m_vLayerGCode.push_back(std::move(step));
+}
+
+void GCodeFileParser::FlushStep()
+{
+    AddStep(GCodeStep(m_CurrentStep));
 
     // Clear next gcode step
     m_CurrentStep.m_Comment.clear();
@@ -185,72 +434,460 @@ void GCodeFileParser::FlushStep()
 void GCodeFileParser::Comment(const vector<char>& v)
 {
     m_CurrentStep.m_Comment = string(v.begin(),v.end());
+    CommentFeature(m_CurrentStep,v);
 }
 
 /** Boost.Spirit grammar of a g-code step
+ *
+ * @tparam Sink Receiver of the parsed values, with a current step m_CurrentStep,
+ * and the methods Comment and FlushStep
+ * @tparam Iterator Iterator on the characters of the line
  */
-struct gcode_grammar : grammar<string::iterator>
+template<class Sink,class Iterator>
+struct gcode_grammar : grammar<Iterator>
 {
-    GCodeFileParser& data;
-    gcode_grammar(GCodeFileParser& data_) : gcode_grammar::base_type(start),data(data_)
+    Sink& data;
+    gcode_grammar(Sink& data_) : gcode_grammar::base_type(start),data(data_)
     {
-        start = -instruction >> -comment >> eps[phx::bind(&GCodeFileParser::FlushStep,&data)];
+        start = -instruction >> -comment >> eps[phx::bind(&Sink::FlushStep,&data)];
     }
-    rule<string::iterator> comment =
-        (";" >> *char_)[phx::bind(&GCodeFileParser::Comment,&data,qi::_1)];
-    rule<string::iterator> param =
+    rule<Iterator> comment =
+        (";" >> *char_)[phx::bind(&Sink::Comment,&data,qi::_1)];
+    rule<Iterator> param =
         ("X" >> double_)[phx::ref(data.m_CurrentStep.m_X) = qi::_1] |
         ("Y" >> double_)[phx::ref(data.m_CurrentStep.m_Y) = qi::_1] |
         ("Z" >> double_)[phx::ref(data.m_CurrentStep.m_Z) = qi::_1] |
         ("E" >> double_)[phx::ref(data.m_CurrentStep.m_E) = qi::_1] |
-        ("F" >> double_)[phx::ref(data.m_CurrentStep.m_F) = qi::_1]
+        ("F" >> double_)[phx::ref(data.m_CurrentStep.m_F) = qi::_1] |
+        ("I" >> double_)[phx::ref(data.m_CurrentStep.m_I) = qi::_1] |
+        ("J" >> double_)[phx::ref(data.m_CurrentStep.m_J) = qi::_1]
         ;
-    rule<string::iterator> ins_g0 =
+    rule<Iterator> ins_g0 =
         (lit("G0") >> +char_(' ') >> (param % ' '))[phx::ref(data.m_CurrentStep.m_Step) = GC_MoveFast];
-    rule<string::iterator> ins_m107 =
+    rule<Iterator> ins_m107 =
         lit("M107")[phx::ref(data.m_CurrentStep.m_Step) = GC_FanOff];
-    rule<string::iterator> ins_g1 =
+    rule<Iterator> ins_g1 =
         ("G1" >> +char_(' ') >> (param % ' '))[phx::ref(data.m_CurrentStep.m_Step) = GC_MoveLin];
-    rule<string::iterator> ins_g10 =
+    rule<Iterator> ins_g2 =
+        ("G2" >> +char_(' ') >> (param % ' '))[phx::ref(data.m_CurrentStep.m_Step) = GC_ArcCW];
+    rule<Iterator> ins_g3 =
+        ("G3" >> +char_(' ') >> (param % ' '))[phx::ref(data.m_CurrentStep.m_Step) = GC_ArcCCW];
+    rule<Iterator> ins_g10 =
         lit("G10")[phx::ref(data.m_CurrentStep.m_Step) = GC_RetractStart];
-    rule<string::iterator> ins_g11 =
+    rule<Iterator> ins_g11 =
         lit("G11")[phx::ref(data.m_CurrentStep.m_Step) = GC_RetractStop];
-    rule<string::iterator> ins_m106 =
+    rule<Iterator> ins_m106 =
         ("M106" >> +char_(' ') >> "S" >> int_)[phx::ref(data.m_CurrentStep.m_S) = qi::_2][phx::ref(data.m_CurrentStep.m_Step) = GC_FanOn];
-    rule<string::iterator> ins_g92 =
+    rule<Iterator> ins_g92 =
         (lit("G92") >> +char_(' ') >> (param % ' '))[phx::ref(data.m_CurrentStep.m_Step) = GC_DefinePos];
-    rule<string::iterator> instruction =
-        ins_g0 | ins_m107 | ins_g1 | ins_g10 | ins_g11 | ins_m106 | ins_g92;
-    rule<string::iterator> start;
+    rule<Iterator> instruction =
+        ins_g0 | ins_m107 | ins_g1 | ins_g10 | ins_g11 | ins_m106 | ins_g92 | ins_g2 | ins_g3;
+    rule<Iterator> start;
 };
 
-void GCodeParser(StretchAlgorithm *algo,istream& is)
+/** Parses a line of g-code, '\r' at the end of the line removed
+ *
+ * @param g Grammar, with the receiver of the parsed values
+ * @param str Line
+ * @param nLine Number of the line in the file, from 1
+ */
+template<class Grammar>
+static void ParseLine(const Grammar& g,string& str,int nLine)
 {
-    string str;
+    if (str.size() && str[str.size() -1] == '\r')
+        str.resize(str.size()-1);
+    string::iterator it = str.begin();
+    bool res = parse(
+            it,
+            str.end(),
+            g
+            );
+    if (!res)
+    {
+        cerr << "Error line " << nLine << endl;
+        throw std::runtime_error("Invalid gcode");
+    }
+    if (it != str.end())
+    {
+        cerr << "Line " << nLine << " parsing stopped pos (" << it-str.begin() << ")" << endl;
+        throw std::runtime_error("Invalid gcode");
+    }
+}
+
+/** Fan speed not set since the beginning of a chunk */
+static const int UnsetS = INT_MIN;
+/** Feature type not set since the beginning of a chunk */
+static const EFeature UnsetFeature = FT_Count;
+
+/** Parser of a chunk of lines, independent of the previous chunks
+ *
+ * The values not set since the beginning of the chunk are NaN (@ref UnsetS for the fan speed,
+ * @ref UnsetFeature for the feature type).
+ * They are inherited from the modal state at the end of the previous chunks, once known.
+ */
+struct GCodeChunkParser
+{
+    GCodeStep m_CurrentStep /** Modal state, then state at the end of the chunk */;
+    vector<GCodeStep> m_vSteps /** Parsed steps, one per line */;
+    int m_nErrorLine /** Line of the chunk, from 1, where the parsing failed, or 0 */;
+    int m_nErrorPos /** Position where the parsing stopped in the line, or -1 if the line is invalid */;
+
+    GCodeChunkParser() :
+        m_nErrorLine(0),
+        m_nErrorPos(-1)
+    {
+        const double nan = numeric_limits<double>::quiet_NaN();
+        m_CurrentStep.m_X = nan;
+        m_CurrentStep.m_Y = nan;
+        m_CurrentStep.m_Z = nan;
+        m_CurrentStep.m_E = nan;
+        m_CurrentStep.m_F = nan;
+        m_CurrentStep.m_I = nan;
+        m_CurrentStep.m_J = nan;
+        m_CurrentStep.m_S = UnsetS;
+        m_CurrentStep.m_Feature = UnsetFeature;
+    }
+
+    void Comment(const vector<char>& v)
+    {
+        m_CurrentStep.m_Comment = string(v.begin(),v.end());
+        CommentFeature(m_CurrentStep,v);
+    }
+
+    void FlushStep()
+    {
+        m_vSteps.push_back(m_CurrentStep);
+        m_CurrentStep.m_Comment.clear();
+        m_CurrentStep.m_Step = GC_NOP;
+    }
+
+    /** Parses the lines from begin to end, stopping at the first invalid line */
+    void Parse(const char *begin,const char *end);
+
+    /** Modal state at the end of the chunk
+     *
+     * @param state Modal state at the end of the previous chunks, without unset values
+     */
+    GCodeStep EndState(const GCodeStep& state) const;
+
+    /** Replaces the values not set in the chunk by the modal state before the chunk
+     *
+     * @param state Modal state at the end of the previous chunks, without unset values
+     */
+    void Resolve(const GCodeStep& state);
+};
+
+void GCodeChunkParser::Parse(const char *begin,const char *end)
+{
+    gcode_grammar<GCodeChunkParser,const char *> gcode_grammar_obj(*this);
     int nLine = 0;
-    GCodeFileParser data(algo);
-    gcode_grammar gcode_grammar_obj(data);
-    while (!getline(is,str).fail())
+    for (const char *line = begin;line < end;)
     {
         ++nLine;
-        if (str.size() && str[str.size() -1] == '\r')
-            str.resize(str.size()-1);
-        string::iterator it = str.begin();
-        bool res = parse(
-                it,
-                str.end(),
-                gcode_grammar_obj
-                );
-        if (!res)
+        const char *eol = (const char *)memchr(line,'\n',end - line);
+        const char *next = eol ? eol + 1 : end;
+        if (!eol)
+            eol = end;
+        if (eol > line && eol[-1] == '\r')
+            eol--;
+        const char *it = line;
+        bool res = parse(it,eol,gcode_grammar_obj);
+        if (!res || it != eol)
+        {
+            m_nErrorLine = nLine;
+            m_nErrorPos = res ? it - line : -1;
+            return;
+        }
+        line = next;
+    }
+}
+
+/** Replaces an unset value by the inherited one */
+static void Inherit(double& v,double inherited)
+{
+    if (std::isnan(v))
+        v = inherited;
+}
+
+/** Replaces the unset values of a step by the inherited ones */
+static void Inherit(GCodeStep& step,const GCodeStep& state)
+{
+    Inherit(step.m_X,state.m_X);
+    Inherit(step.m_Y,state.m_Y);
+    Inherit(step.m_Z,state.m_Z);
+    Inherit(step.m_E,state.m_E);
+    Inherit(step.m_F,state.m_F);
+    Inherit(step.m_I,state.m_I);
+    Inherit(step.m_J,state.m_J);
+    if (step.m_S == UnsetS)
+        step.m_S = state.m_S;
+    if (step.m_Feature == UnsetFeature)
+        step.m_Feature = state.m_Feature;
+}
+
+GCodeStep GCodeChunkParser::EndState(const GCodeStep& state) const
+{
+    GCodeStep end(m_CurrentStep);
+    Inherit(end,state);
+    return end;
+}
+
+void GCodeChunkParser::Resolve(const GCodeStep& state)
+{
+    for (auto i = m_vSteps.begin();i != m_vSteps.end();i++)
+        Inherit(*i,state);
+}
+
+/** Size of the input read at once for each parsing thread */
+static const size_t ParseBlockSize = 1 << 22;
+/** Number of chunks of a block for each parsing thread, to balance the load */
+static const int ChunksPerThread = 4;
+
+/** Parses the input stream in chunks parsed in parallel
+ *
+ * The input is read by blocks, split at line boundaries in chunks.
+ * Each chunk is parsed independently, then the values inherited from the previous
+ * chunks are set and the steps are processed in order, exactly like the serial parser.
+ */
+static void GCodeParallelParser(GCodeFileParser& data,istream& is,int nThreads)
+{
+    const int nChunks = nThreads * ChunksPerThread;
+    GCodeStep state; // Modal state at the beginning of the block
+    string block;
+    string rest; // Beginning of a line not terminated at the end of the previous block
+    int nLine = 0;
+    bool bEof = false;
+    while (!bEof)
+    {
+        size_t wanted = ParseBlockSize * nThreads;
+        block.swap(rest);
+        size_t sz = block.size();
+        block.resize(sz + wanted);
+        is.read(&block[sz],wanted);
+        block.resize(sz + is.gcount());
+        bEof = (size_t)is.gcount() < wanted;
+        rest.clear();
+        if (!bEof)
+        {
+            size_t last = block.rfind('\n');
+            if (last == string::npos)
+            {
+                // Line longer than a block
+                rest.swap(block);
+                continue;
+            }
+            rest.assign(block,last + 1,string::npos);
+            block.resize(last + 1);
+        }
+        /*
+         * Chunks of about the same size, ending at the end of a line
+         */
+        const char *begin = block.data();
+        const char *end = begin + block.size();
+        vector<const char *> vBounds(1,begin);
+        for (int k=1;k<nChunks;k++)
+        {
+            const char *p = max(vBounds.back(),begin + block.size() * k / nChunks);
+            const char *eol = p < end ? (const char *)memchr(p,'\n',end - p) : NULL;
+            vBounds.push_back(eol ? eol + 1 : end);
+        }
+        vBounds.push_back(end);
+        vector<GCodeChunkParser> vChunks(nChunks);
+        #pragma omp parallel for num_threads(nThreads) schedule(dynamic)
+        for (int k=0;k<nChunks;k++)
+        {
+            double start = TraceEnabled() ? TraceNow() : 0;
+            vChunks[k].Parse(vBounds[k],vBounds[k+1]);
+            if (TraceEnabled())
+                TraceEvent("ParseChunk",start,vChunks[k].m_vSteps.size());
+        }
+        /*
+         * Prefix scan of the modal states at the end of the chunks,
+         * then the inherited values are set in parallel
+         */
+        vector<GCodeStep> vState(nChunks + 1);
+        vState[0] = state;
+        for (int k=0;k<nChunks;k++)
+            vState[k+1] = vChunks[k].EndState(vState[k]);
+        state = vState[nChunks];
+        #pragma omp parallel for num_threads(nThreads)
+        for (int k=0;k<nChunks;k++)
+            vChunks[k].Resolve(vState[k]);
+        for (int k=0;k<nChunks;k++)
+        {
+            GCodeChunkParser& chunk = vChunks[k];
+            for (auto i = chunk.m_vSteps.begin();i != chunk.m_vSteps.end();i++)
+                data.AddStep(std::move(*i));
+            if (chunk.m_nErrorLine)
+            {
+                nLine += chunk.m_nErrorLine;
+                if (chunk.m_nErrorPos < 0)
+                    cerr << "Error line " << nLine << endl;
+                else
+                    cerr << "Line " << nLine << " parsing stopped pos (" << chunk.m_nErrorPos << ")" << endl;
+                throw std::runtime_error("Invalid gcode");
+            }
+            nLine += chunk.m_vSteps.size();
+        }
+    }
+}
+
+void GCodeParser(StretchAlgorithm *algo,istream& is,const Params& params,StepCache *cache)
+{
+    GCodeFileParser data(algo,params);
+    ofstream osPatch;
+    unique_ptr<PatchWriter> patch;
+    if (!params.patch.empty())
+    {
+        osPatch.open(params.patch.c_str(),ios::binary);
+        if (!osPatch.is_open())
+            throw std::runtime_error("Unable to write patch file " + params.patch);
+        patch.reset(new PatchWriter(osPatch));
+        data.m_pPatch = patch.get();
+    }
+    if (cache && cache->Valid())
+    {
+        // The steps are processed exactly as if they were parsed
+        GCodeStep step;
+        for (size_t i=0;i<cache->Size();i++)
         {
-            cerr << "Error line " << nLine << endl;
-            throw std::runtime_error("Invalid gcode");
+            cache->Get(i,step);
+            data.AddStep(std::move(step));
         }
-        if (it != str.end())
+    }
+    else if (params.parseThreads > 1)
+    {
+        data.m_pCache = cache;
+        GCodeParallelParser(data,is,params.parseThreads);
+    }
+    else
+    {
+        data.m_pCache = cache;
+        string str;
+        int nLine = 0;
+        gcode_grammar<GCodeFileParser,string::iterator> gcode_grammar_obj(data);
+        while (!getline(is,str).fail())
+            ParseLine(gcode_grammar_obj,str,++nLine);
+    }
+    data.Flush();
+    if (params.arcTolerance > 0)
+        cerr << "Arc fitting: " << data.m_nArcRemoved << " lines removed" << endl;
+    if (patch)
+    {
+        patch->Close();
+        if (!osPatch)
+            throw std::runtime_error("Unable to write patch file " + params.patch);
+        cerr << "Patch: " << patch->Count() << " of " << data.m_nLines << " lines" << endl;
+    }
+}
+
+/** Receiver of the parsed values recording the beginning of each layer */
+struct GCodeIndexSink
+{
+    GCodeStep m_CurrentStep;
+    /** Modal state before the current line */
+    GCodeStep m_State;
+    /** Offset of the current line */
+    long long m_Offset;
+    /** Z position of the current layer */
+    double m_ZLayer;
+    /** Number of the current line, from 1 */
+    int m_nLine;
+    vector<GCodeLayerIndex>& m_vIndex;
+
+    GCodeIndexSink(vector<GCodeLayerIndex>& vIndex) :
+        m_Offset(0),
+        m_ZLayer(0),
+        m_nLine(0),
+        m_vIndex(vIndex) {}
+
+    void Comment(const vector<char>& v)
+    {
+        CommentFeature(m_CurrentStep,v);
+    }
+
+    void FlushStep()
+    {
+        // Same rule as GCodeFileParser: a layer is a run of steps with the same Z
+        if (m_vIndex.empty() || m_ZLayer != m_CurrentStep.m_Z)
         {
-            cerr << "Line " << nLine << " parsing stopped pos (" << it-str.begin() << ")" << endl;
-            throw std::runtime_error("Invalid gcode");
+            GCodeLayerIndex layer;
+            layer.m_Offset = m_Offset;
+            layer.m_nLine = m_nLine;
+            layer.m_nSteps = 0;
+            layer.m_State = m_State;
+            m_vIndex.push_back(layer);
+            m_ZLayer = m_CurrentStep.m_Z;
         }
+        m_vIndex.back().m_nSteps++;
+        m_CurrentStep.m_Step = GC_NOP;
+        m_State = m_CurrentStep;
+    }
+};
+
+void GCodeIndex(istream& is,vector<GCodeLayerIndex>& vIndex)
+{
+    vIndex.clear();
+    GCodeIndexSink data(vIndex);
+    gcode_grammar<GCodeIndexSink,string::iterator> gcode_grammar_obj(data);
+    string str;
+    while (!getline(is,str).fail())
+    {
+        size_t sz = str.size() + 1;
+        data.m_nLine++;
+        ParseLine(gcode_grammar_obj,str,data.m_nLine);
+        data.m_Offset += sz;
+    }
+}
+
+void GCodeParseLayers(StretchAlgorithm *algo,istream& is,const vector<GCodeLayerIndex>& vIndex,
+        int first,int last,const Params& params)
+{
+    assert(first >= 1 && first <= last && (size_t)last <= vIndex.size());
+    const GCodeLayerIndex& layer = vIndex[first-1];
+    is.clear();
+    is.seekg(layer.m_Offset);
+    if (!is)
+        throw std::runtime_error("Unable to seek to the layer");
+    GCodeFileParser data(algo,params);
+    data.m_nLayer = first - 1;
+    data.m_ZLayer = layer.m_State.m_Z;
+    data.m_CurrentStep = layer.m_State;
+    // The steps before the layer are not written, only the changes since its modal state are
+    data.m_Writer.Reset(layer.m_State);
+    gcode_grammar<GCodeFileParser,string::iterator> gcode_grammar_obj(data);
+    string str;
+    int nLines = 0;
+    for (int n=first;n<=last;n++)
+        nLines += vIndex[n-1].m_nSteps;
+    for (int n=0;n<nLines;n++)
+    {
+        if (getline(is,str).fail())
+            throw std::runtime_error("The layer index does not match the g-code file");
+        ParseLine(gcode_grammar_obj,str,layer.m_nLine + n);
     }
     data.Flush();
+    if (data.m_nLayer != last)
+        throw std::runtime_error("The layer index does not match the g-code file");
+    if ((size_t)last < vIndex.size())
+    {
+        /*
+         * The following lines are not written by the writer, they rely on the modal
+         * position of the input file, which may have been moved by the processing
+         */
+        const GCodeStep& next = vIndex[last].m_State;
+        if (data.m_Writer.m_CurX != next.m_X || data.m_Writer.m_CurY != next.m_Y)
+        {
+            // From the state of the writer, the steps of the layer being no longer kept in streaming mode
+            GCodeStep restore;
+            restore.m_Step = GC_MoveFast;
+            restore.m_X = next.m_X;
+            restore.m_Y = next.m_Y;
+            restore.m_Z = data.m_Writer.m_CurZ;
+            restore.m_E = data.m_Writer.m_CurE;
+            restore.m_F = data.m_Writer.m_CurF;
+            restore.m_Comment = "Position restored";
+            data.m_Writer.Write(restore);
+        }
+    }
 }
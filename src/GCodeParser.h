@@ -2,12 +2,57 @@
 #define _GCODEPARSER_H
 
 #include "StretchAlgorithm.h"
+#include "LayerIndex.h"
 #include <istream>
+#include <vector>
+#include <string>
+
+class Params;
+class StepCache;
 
 /** Parse G-Code from the input stream is
  * @param algo Applied algorithm
+ * @param is Input stream
+ * @param params Global parameters
+ * @param cache If not NULL, cache of the parsed steps of the input file: if it is valid,
+ * the steps are read from it instead of the input stream, otherwise the parsed steps are recorded in it
  */
-void GCodeParser(StretchAlgorithm *algo,std::istream& is);
+void GCodeParser(StretchAlgorithm *algo,std::istream& is,const Params& params,StepCache *cache = NULL);
 
-#endif
+/** Feature type of a name of the ;TYPE: comments of Cura
+ *
+ * The names are WALL-OUTER, WALL-INNER, SKIN, FILL, SKIRT, SUPPORT, SUPPORT-INTERFACE,
+ * and NONE and OTHER for @ref FT_None and @ref FT_Other. The case is ignored.
+ *
+ * @param name Name of the type
+ * @param feature Feature type
+ * @return false if the name is unknown
+ */
+bool GCodeFeature(const std::string& name,EFeature& feature);
+
+/** Builds the index of the layers of a g-code file
+ *
+ * The layers are the same as the ones processed by @ref GCodeParser
+ *
+ * @param is Input stream, at the beginning of the file
+ * @param vIndex Index of each layer
+ */
+void GCodeIndex(std::istream& is,std::vector<GCodeLayerIndex>& vIndex);
 
+/** Parses, processes and writes a range of layers
+ *
+ * Only the changes since the modal state of the beginning of the first layer are written.
+ * If the processing moved the last position, a move back to the position of the input
+ * file is written, so that the lines following the range may be copied unchanged.
+ *
+ * @param algo Applied algorithm
+ * @param is Input stream, seekable
+ * @param vIndex Index of the layers, from @ref GCodeIndex
+ * @param first Number of the first layer, from 1
+ * @param last Number of the last layer
+ * @param params Global parameters
+ */
+void GCodeParseLayers(StretchAlgorithm *algo,std::istream& is,const std::vector<GCodeLayerIndex>& vIndex,
+        int first,int last,const Params& params);
+
+#endif
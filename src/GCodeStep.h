@@ -17,7 +17,25 @@ enum EGCodeStep
     GC_RetractStop /**< End of retraction, restarts extrusion */,
     GC_MoveFast /**< Fast movement */,
     GC_MoveLin /**< Linear movement */,
-    GC_DefinePos /**< Origin redefinition */
+    GC_DefinePos /**< Origin redefinition */,
+    GC_ArcCW /**< Clockwise arc */,
+    GC_ArcCCW /**< Counter-clockwise arc */
+};
+
+/** Feature types of the moves, given by the ;TYPE: comments of Cura
+ *
+ * */
+enum EFeature
+{
+    FT_None /**< No type given since the beginning of the file */,
+    FT_WallOuter /**< Outer wall, WALL-OUTER */,
+    FT_WallInner /**< Inner walls, WALL-INNER */,
+    FT_Skin /**< Top and bottom surfaces, SKIN */,
+    FT_Fill /**< Infill, FILL */,
+    FT_Skirt /**< Skirt or brim, SKIRT */,
+    FT_Support /**< Support, SUPPORT and SUPPORT-INTERFACE */,
+    FT_Other /**< Any other type */,
+    FT_Count /**< Number of feature types */
 };
 
 /** @brief G-Code step */
@@ -31,17 +49,23 @@ class GCodeStep
         double m_Z /** Current Z position */;
         double m_E /** Current extrusion position */;
         double m_F /** Speed at the end of the movement */;
+        double m_I /** Arc center X offset from the start position */;
+        double m_J /** Arc center Y offset from the start position */;
         int m_S /** Fan speed */;
         std::string m_Comment /** Comment */;
+        EFeature m_Feature /** Feature type of the step, from the last ;TYPE: comment */;
 
         GCodeStep() :
+            m_Step(GC_NOP),
             m_X(0),
             m_Y(0),
             m_Z(0),
             m_E(0),
             m_F(0),
+            m_I(0),
+            m_J(0),
             m_S(0),
-            m_Step(GC_NOP) {}
+            m_Feature(FT_None) {}
 };
 
 #endif
@@ -0,0 +1,112 @@
+#include "LayerIndex.h"
+#include <fstream>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/*
+ * Index file format, in the native byte order:
+ *
+ * Header: magic (8 bytes), size and modification time of the g-code file, number of layers (int64)
+ * Each layer: offset (int64), first line, number of steps, fan speed, feature type (int32), X Y Z E F I J (double)
+ */
+
+/** Magic number and version of the index file */
+static const char IndexMagic[8] = {'P','S','I','D','X','0','0','2'};
+
+/** Size and modification time of a file */
+static bool FileStamp(const string& file,int64_t& size,int64_t& mtime)
+{
+    struct stat st;
+    if (stat(file.c_str(),&st) != 0)
+        return false;
+    size = st.st_size;
+    mtime = st.st_mtime;
+    return true;
+}
+
+template<class T>
+static void Write(ostream& os,T v)
+{
+    os.write((const char *)&v,sizeof(v));
+}
+
+template<class T>
+static bool Read(istream& is,T& v)
+{
+    return !is.read((char *)&v,sizeof(v)).fail();
+}
+
+string LayerIndexFile(const string& gcodeFile)
+{
+    return gcodeFile + ".idx";
+}
+
+bool LayerIndexLoad(const string& gcodeFile,vector<GCodeLayerIndex>& vIndex)
+{
+    vIndex.clear();
+    int64_t size,mtime;
+    if (!FileStamp(gcodeFile,size,mtime))
+        return false;
+    ifstream is(LayerIndexFile(gcodeFile).c_str(),ios::binary);
+    char magic[sizeof(IndexMagic)];
+    int64_t idxSize,idxMtime,nLayers;
+    if (!is.read(magic,sizeof(magic)) || memcmp(magic,IndexMagic,sizeof(magic))
+            || !Read(is,idxSize) || !Read(is,idxMtime) || !Read(is,nLayers)
+            || idxSize != size || idxMtime != mtime || nLayers < 0)
+        return false;
+    for (int64_t n=0;n<nLayers;n++)
+    {
+        GCodeLayerIndex layer;
+        int64_t offset;
+        int32_t nLine,nSteps,s,feature;
+        GCodeStep& st = layer.m_State;
+        if (!Read(is,offset) || !Read(is,nLine) || !Read(is,nSteps) || !Read(is,s) || !Read(is,feature)
+                || !Read(is,st.m_X) || !Read(is,st.m_Y) || !Read(is,st.m_Z) || !Read(is,st.m_E)
+                || !Read(is,st.m_F) || !Read(is,st.m_I) || !Read(is,st.m_J)
+                || feature < 0 || feature >= FT_Count)
+        {
+            vIndex.clear();
+            return false;
+        }
+        layer.m_Offset = offset;
+        layer.m_nLine = nLine;
+        layer.m_nSteps = nSteps;
+        st.m_S = s;
+        st.m_Feature = (EFeature)feature;
+        vIndex.push_back(layer);
+    }
+    return true;
+}
+
+bool LayerIndexSave(const string& gcodeFile,const vector<GCodeLayerIndex>& vIndex)
+{
+    int64_t size,mtime;
+    if (!FileStamp(gcodeFile,size,mtime))
+        return false;
+    ofstream os(LayerIndexFile(gcodeFile).c_str(),ios::binary);
+    os.write(IndexMagic,sizeof(IndexMagic));
+    Write<int64_t>(os,size);
+    Write<int64_t>(os,mtime);
+    Write<int64_t>(os,vIndex.size());
+    for (auto i = vIndex.begin();i != vIndex.end();i++)
+    {
+        const GCodeStep& st = i->m_State;
+        Write<int64_t>(os,i->m_Offset);
+        Write<int32_t>(os,i->m_nLine);
+        Write<int32_t>(os,i->m_nSteps);
+        Write<int32_t>(os,st.m_S);
+        Write<int32_t>(os,st.m_Feature);
+        Write(os,st.m_X);
+        Write(os,st.m_Y);
+        Write(os,st.m_Z);
+        Write(os,st.m_E);
+        Write(os,st.m_F);
+        Write(os,st.m_I);
+        Write(os,st.m_J);
+    }
+    os.close();
+    return !os.fail();
+}
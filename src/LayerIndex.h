@@ -0,0 +1,39 @@
+#ifndef _LAYERINDEX_H
+#define _LAYERINDEX_H
+
+/** @file */
+
+#include <string>
+#include <vector>
+#include "GCodeStep.h"
+
+/** @brief Position and modal state of the beginning of a layer in a g-code file */
+struct GCodeLayerIndex
+{
+    long long m_Offset /** Offset of the first line of the layer */;
+    int m_nLine /** Number of the first line of the layer, from 1 */;
+    int m_nSteps /** Number of steps, i.e. lines, of the layer */;
+    GCodeStep m_State /** Modal state before the first line of the layer */;
+};
+
+/** Name of the index file of a g-code file */
+std::string LayerIndexFile(const std::string& gcodeFile);
+
+/** Reads the index file of a g-code file
+ *
+ * @param gcodeFile Name of the g-code file
+ * @param vIndex Index of each layer
+ * @return false if there is no index file, or if the g-code file changed since the index was written
+ */
+bool LayerIndexLoad(const std::string& gcodeFile,std::vector<GCodeLayerIndex>& vIndex);
+
+/** Writes the index file of a g-code file
+ *
+ * The size and the modification time of the g-code file are recorded,
+ * in order to detect an outdated index.
+ *
+ * @return false if the file could not be written
+ */
+bool LayerIndexSave(const std::string& gcodeFile,const std::vector<GCodeLayerIndex>& vIndex);
+
+#endif
@@ -0,0 +1,91 @@
+#include "LayerReuse.h"
+#include <math.h>
+
+using namespace std;
+
+/** Bit of the pattern set if the extrusion of the step is the one of the previous step */
+static const unsigned char SameExtrusion = 0x80;
+/** Position of the feature type in the pattern, the feature types may be processed differently */
+static const int FeatureShift = 4;
+
+/** Position in microns */
+static long long Micron(double v)
+{
+    return (long long)floor(v * 1000.0 + 0.5);
+}
+
+/** FNV-1a hash of a value */
+static void Hash(uint64_t& h,uint64_t v)
+{
+    for (int i=0;i<8;i++)
+    {
+        h ^= (v >> (8*i)) & 0xff;
+        h *= 1099511628211ULL;
+    }
+}
+
+LayerReuse::LayerReuse(int nLayers) :
+    m_nLayers(nLayers)
+{
+}
+
+uint64_t LayerReuse::Fingerprint(const vector<GCodeStep>& v,
+        const vector<pair<double,double>>& vPos,
+        vector<unsigned char>& vPattern) const
+{
+    uint64_t h = 14695981039346656037ULL;
+    vPattern.resize(v.size());
+    if (v.empty())
+        return h;
+    for (int i=0;i<v.size();i++)
+    {
+        unsigned char c = (unsigned char)v[i].m_Step | (unsigned char)(v[i].m_Feature << FeatureShift);
+        if (i == 0 || v[i].m_E == v[i-1].m_E)
+            c |= SameExtrusion;
+        vPattern[i] = c;
+        Hash(h,c);
+        Hash(h,Micron(vPos[i].first));
+        Hash(h,Micron(vPos[i].second));
+    }
+    return h;
+}
+
+bool LayerReuse::Find(const vector<GCodeStep>& v,vector<pair<double,double>>& vOut) const
+{
+    vector<pair<double,double>> vPos;
+    vPos.reserve(v.size());
+    for (auto i = v.begin();i != v.end();i++)
+        vPos.push_back(make_pair(i->m_X,i->m_Y));
+    vector<unsigned char> vPattern;
+    uint64_t h = Fingerprint(v,vPos,vPattern);
+    for (auto e = m_dqEntries.begin();e != m_dqEntries.end();e++)
+    {
+        if (e->m_Hash != h || e->m_vPattern != vPattern)
+            continue;
+        /*
+         * Same positions: the processing gives the same result
+         */
+        bool bExact = true;
+        for (int i=0;bExact && i<v.size();i++)
+            bExact = v[i].m_X == e->m_vIn[i].first && v[i].m_Y == e->m_vIn[i].second;
+        if (bExact)
+        {
+            vOut = e->m_vOut;
+            return true;
+        }
+    }
+    return false;
+}
+
+void LayerReuse::Record(const vector<pair<double,double>>& vIn,const vector<GCodeStep>& v)
+{
+    Entry e;
+    e.m_Hash = Fingerprint(v,vIn,e.m_vPattern);
+    e.m_vIn = vIn;
+    e.m_vOut.reserve(v.size());
+    for (auto i = v.begin();i != v.end();i++)
+        e.m_vOut.push_back(make_pair(i->m_X,i->m_Y));
+    m_dqEntries.push_front(e);
+    if (m_dqEntries.size() > m_nLayers)
+        m_dqEntries.pop_back();
+}
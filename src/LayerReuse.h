@@ -0,0 +1,69 @@
+#ifndef _LAYERREUSE_H
+#define _LAYERREUSE_H
+
+/** @file */
+
+#include <vector>
+#include <deque>
+#include <utility>
+#include <stdint.h>
+#include "GCodeStep.h"
+
+/** @brief Results of the processing of the last layers, replayed on layers with the same geometry
+ *
+ * The processing of a layer only depends on the type and the position of its steps,
+ * and on which steps keep the extrusion of the previous one (starting a new sequence).
+ * A layer with the same steps gives the same result, which is replayed.
+ *
+ * Only the layers with exactly the same positions are replayed: the processing of translated
+ * positions is not guaranteed to give the translated result, the rounding of the computations
+ * and the grids of the contact engines being different.
+ */
+class LayerReuse
+{
+    public:
+        /**
+         * @param nLayers Number of processed layers kept
+         */
+        LayerReuse(int nLayers);
+
+        /** Looks for a processed layer with the same geometry
+         *
+         * @param v Steps of the layer, not processed
+         * @param vOut Processed positions of the steps, if found
+         * @return true if a layer was found
+         */
+        bool Find(const std::vector<GCodeStep>& v,std::vector<std::pair<double,double>>& vOut) const;
+
+        /** Records the processing of a layer, replacing the oldest one
+         *
+         * @param vIn Positions of the steps before the processing
+         * @param v Steps of the layer, processed
+         */
+        void Record(const std::vector<std::pair<double,double>>& vIn,const std::vector<GCodeStep>& v);
+
+    private:
+        /** Processed layer */
+        struct Entry
+        {
+            uint64_t m_Hash /** Hash of the geometry, see @ref Fingerprint */;
+            std::vector<unsigned char> m_vPattern /** Type and feature type of each step, and bit of constant extrusion */;
+            std::vector<std::pair<double,double>> m_vIn /** Positions before the processing */;
+            std::vector<std::pair<double,double>> m_vOut /** Positions after the processing */;
+        };
+        int m_nLayers;
+        std::deque<Entry> m_dqEntries /** Most recent layer first */;
+
+        /** Type of each step, with the bit of constant extrusion
+         *
+         * @param v Steps of the layer
+         * @param vPos Positions of the steps before the processing
+         * @param vPattern Type and feature type of each step, with the bit of constant extrusion
+         * @return Hash of the pattern and of the positions at the micron
+         */
+        uint64_t Fingerprint(const std::vector<GCodeStep>& v,
+                const std::vector<std::pair<double,double>>& vPos,
+                std::vector<unsigned char>& vPattern) const;
+};
+
+#endif
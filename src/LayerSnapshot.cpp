@@ -0,0 +1,187 @@
+#include "LayerSnapshot.h"
+#include <sstream>
+#include <string.h>
+#include <stdint.h>
+
+using namespace std;
+
+/** Magic number and version of the snapshot file */
+static const char SnapshotMagic[8] = {'P','S','S','N','A','P','0','7'};
+
+/** Writes the n low bytes of a value, least significant first */
+static void WriteBytes(ostream& os,uint64_t v,int n)
+{
+    char b[8];
+    for (int i=0;i<n;i++)
+        b[i] = (char)(v >> (8*i));
+    os.write(b,n);
+}
+
+/** Reads n bytes written by @ref WriteBytes */
+static bool ReadBytes(istream& is,uint64_t& v,int n)
+{
+    unsigned char b[8];
+    if (is.read((char *)b,n).fail())
+        return false;
+    v = 0;
+    for (int i=0;i<n;i++)
+        v |= (uint64_t)b[i] << (8*i);
+    return true;
+}
+
+static void Write(ostream& os,uint8_t v) { WriteBytes(os,v,1); }
+static void Write(ostream& os,int32_t v) { WriteBytes(os,(uint32_t)v,4); }
+static void Write(ostream& os,uint32_t v) { WriteBytes(os,v,4); }
+static void Write(ostream& os,int64_t v) { WriteBytes(os,(uint64_t)v,8); }
+
+static void Write(ostream& os,double v)
+{
+    uint64_t u;
+    memcpy(&u,&v,sizeof(u));
+    WriteBytes(os,u,8);
+}
+
+template<class T>
+static bool Read(istream& is,T& v)
+{
+    uint64_t u;
+    if (!ReadBytes(is,u,sizeof(T)))
+        return false;
+    v = (T)u;
+    return true;
+}
+
+static bool Read(istream& is,double& v)
+{
+    uint64_t u;
+    if (!ReadBytes(is,u,8))
+        return false;
+    memcpy(&v,&u,sizeof(v));
+    return true;
+}
+
+/** Reads or writes the parameters changing the result of the processing, in the same order
+ *
+ * How the layer is processed (threads, fused passes, time budget) and what is written
+ * are not saved: the replay is done with the defaults, or with its own options.
+ *
+ * @tparam IO Function object called for each parameter
+ */
+template<class IO>
+static bool Parameters(Params& params,IO io)
+{
+    int32_t stretch = params.stretch;
+    int32_t wallWidth = params.wallWidth;
+    int32_t nozzleDiameter = params.nozzleDiameter;
+    int32_t contact = params.contact;
+    int32_t rasterResolution = params.rasterResolution;
+    int32_t simplify = params.simplify;
+    uint32_t passes = params.passes;
+    int32_t recentSequences = params.recentSequences;
+    double recentLength = params.recentLength;
+    uint32_t correctTypes = params.correctTypes;
+    uint32_t contactTypes = params.contactTypes;
+    bool bOk = io(stretch) && io(wallWidth) && io(nozzleDiameter) && io(contact)
+        && io(rasterResolution) && io(simplify) && io(passes) && io(recentSequences)
+        && io(recentLength) && io(correctTypes) && io(contactTypes);
+    params.stretch = stretch;
+    params.wallWidth = wallWidth;
+    params.nozzleDiameter = nozzleDiameter;
+    params.contact = (EContactMode)contact;
+    params.rasterResolution = rasterResolution;
+    params.simplify = simplify;
+    params.passes = passes;
+    params.recentSequences = recentSequences;
+    params.recentLength = recentLength;
+    params.correctTypes = correctTypes;
+    params.contactTypes = contactTypes;
+    return bOk;
+}
+
+/** Writer of a parameter, for @ref Parameters */
+struct ParamWriter
+{
+    ostream& os;
+    template<class T>
+    bool operator()(T& v) const
+    {
+        Write(os,v);
+        return true;
+    }
+};
+
+/** Reader of a parameter, for @ref Parameters */
+struct ParamReader
+{
+    istream& is;
+    template<class T>
+    bool operator()(T& v) const
+    {
+        return Read(is,v);
+    }
+};
+
+string LayerSnapshotFile(const string& dir,int nLayer)
+{
+    ostringstream ss;
+    ss << dir << "/layer_" << nLayer << ".snap";
+    return ss.str();
+}
+
+void LayerSnapshotWrite(ostream& os,int nLayer,const Params& params,const vector<GCodeStep>& v)
+{
+    os.write(SnapshotMagic,sizeof(SnapshotMagic));
+    Write(os,(int32_t)nLayer);
+    Params p(params);
+    ParamWriter writer = { os };
+    Parameters(p,writer);
+    Write(os,(int64_t)v.size());
+    for (auto i = v.begin();i != v.end();i++)
+    {
+        Write(os,(uint8_t)i->m_Step);
+        Write(os,(uint8_t)i->m_Feature);
+        Write(os,(int32_t)i->m_S);
+        Write(os,i->m_X);
+        Write(os,i->m_Y);
+        Write(os,i->m_Z);
+        Write(os,i->m_E);
+        Write(os,i->m_F);
+        Write(os,i->m_I);
+        Write(os,i->m_J);
+        Write(os,(uint32_t)i->m_Comment.size());
+        os.write(i->m_Comment.data(),i->m_Comment.size());
+    }
+}
+
+bool LayerSnapshotRead(istream& is,int& nLayer,Params& params,vector<GCodeStep>& v)
+{
+    v.clear();
+    char magic[sizeof(SnapshotMagic)];
+    int32_t layer;
+    int64_t n;
+    ParamReader reader = { is };
+    if (!is.read(magic,sizeof(magic)) || memcmp(magic,SnapshotMagic,sizeof(magic))
+            || !Read(is,layer) || !Parameters(params,reader) || !Read(is,n) || n < 0)
+        return false;
+    nLayer = layer;
+    for (int64_t k=0;k<n;k++)
+    {
+        GCodeStep step;
+        uint8_t type,feature;
+        int32_t s;
+        uint32_t len;
+        if (!Read(is,type) || !Read(is,feature) || !Read(is,s)
+                || !Read(is,step.m_X) || !Read(is,step.m_Y) || !Read(is,step.m_Z) || !Read(is,step.m_E)
+                || !Read(is,step.m_F) || !Read(is,step.m_I) || !Read(is,step.m_J) || !Read(is,len)
+                || type > GC_ArcCCW || feature >= FT_Count)
+            return false;
+        step.m_Step = (EGCodeStep)type;
+        step.m_Feature = (EFeature)feature;
+        step.m_S = s;
+        step.m_Comment.resize(len);
+        if (len && !is.read(&step.m_Comment[0],len))
+            return false;
+        v.push_back(step);
+    }
+    return true;
+}
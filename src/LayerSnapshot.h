@@ -0,0 +1,52 @@
+#ifndef _LAYERSNAPSHOT_H
+#define _LAYERSNAPSHOT_H
+
+/** @file */
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "GCodeStep.h"
+#include "params.h"
+
+/*
+ * Snapshot file format, little-endian:
+ *
+ * Magic number (8 bytes), layer number (int32), parameters changing the result
+ * of the processing: stretch, wall width, nozzle diameter, contact engine,
+ * raster resolution, simplification (int32), passes (uint32), recent sequences (int32),
+ * recent length (double), corrected and contact feature types (uint32),
+ * number of steps (int64), then each step: type, feature type (uint8), fan speed (int32),
+ * X Y Z E F I J (double), length of the comment (uint32) and comment.
+ *
+ * The other parameters are not saved.
+ */
+
+/** Name of the snapshot of a layer
+ *
+ * @param dir Directory of the snapshots
+ * @param nLayer Layer number
+ */
+std::string LayerSnapshotFile(const std::string& dir,int nLayer);
+
+/** Writes the input of @ref StretchAlgorithm::Process
+ *
+ * @param os Output stream, binary
+ * @param nLayer Layer number
+ * @param params Parameters of the processing
+ * @param v G-Code steps of the layer, before the processing
+ */
+void LayerSnapshotWrite(std::ostream& os,int nLayer,const Params& params,const std::vector<GCodeStep>& v);
+
+/** Reads a snapshot written by @ref LayerSnapshotWrite
+ *
+ * @param is Input stream, binary
+ * @param nLayer Layer number
+ * @param params Parameters of the processing, the ones not saved are unchanged
+ * @param v G-Code steps of the layer
+ * @return false if the snapshot is invalid or truncated
+ */
+bool LayerSnapshotRead(std::istream& is,int& nLayer,Params& params,std::vector<GCodeStep>& v);
+
+#endif
@@ -0,0 +1,190 @@
+#include "Patch.h"
+#include <stdexcept>
+#include <sstream>
+#include <math.h>
+#include <string.h>
+#include <stdio.h>
+
+using namespace std;
+
+/** Magic number and version of the patch file */
+static const char PatchMagic[8] = {'P','S','P','A','T','C','H','1'};
+
+static void WriteVarint(ostream& os,unsigned long long v)
+{
+    char buf[10];
+    int n = 0;
+    while (v >= 0x80)
+    {
+        buf[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (char)v;
+    os.write(buf,n);
+}
+
+static bool ReadVarint(istream& is,unsigned long long& v)
+{
+    v = 0;
+    for (int shift = 0;shift < 64;shift += 7)
+    {
+        int c = is.get();
+        if (c == EOF)
+            return false;
+        v |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static unsigned long long ZigZag(long long v)
+{
+    return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+static long long UnZigZag(unsigned long long v)
+{
+    return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+static long long Micron(double v)
+{
+    return (long long)floor(v * 1000.0 + 0.5);
+}
+
+PatchWriter::PatchWriter(ostream& os) :
+    m_os(os),
+    m_nLine(0),
+    m_X(0),
+    m_Y(0),
+    m_nRecords(0)
+{
+    m_os.write(PatchMagic,sizeof(PatchMagic));
+}
+
+void PatchWriter::Record(long long nLine,double x,double y)
+{
+    long long ix = Micron(x), iy = Micron(y);
+    WriteVarint(m_os,nLine - m_nLine);
+    WriteVarint(m_os,ZigZag(ix - m_X));
+    WriteVarint(m_os,ZigZag(iy - m_Y));
+    m_nLine = nLine;
+    m_X = ix;
+    m_Y = iy;
+    m_nRecords++;
+}
+
+void PatchWriter::Close()
+{
+    WriteVarint(m_os,0);
+    m_os.flush();
+}
+
+PatchReader::PatchReader(istream& is) :
+    m_is(is),
+    m_nLine(0),
+    m_X(0),
+    m_Y(0),
+    m_bEnd(false)
+{
+    char magic[sizeof(PatchMagic)];
+    if (!m_is.read(magic,sizeof(magic)) || memcmp(magic,PatchMagic,sizeof(magic)))
+        throw runtime_error("Invalid patch file");
+}
+
+bool PatchReader::Next(long long& nLine,long long& x,long long& y)
+{
+    if (m_bEnd)
+        return false;
+    unsigned long long dLine,dx,dy;
+    if (!ReadVarint(m_is,dLine))
+        throw runtime_error("Truncated patch file");
+    if (!dLine)
+    {
+        m_bEnd = true;
+        return false;
+    }
+    if (!ReadVarint(m_is,dx) || !ReadVarint(m_is,dy))
+        throw runtime_error("Truncated patch file");
+    m_nLine += dLine;
+    m_X += UnZigZag(dx);
+    m_Y += UnZigZag(dy);
+    nLine = m_nLine;
+    x = m_X;
+    y = m_Y;
+    return true;
+}
+
+/** Writes a position in microns in mm, without useless zeros */
+static void WriteMicron(ostream& os,long long v)
+{
+    if (v < 0)
+    {
+        os << '-';
+        v = -v;
+    }
+    os << v / 1000;
+    int frac = v % 1000;
+    if (frac)
+    {
+        char buf[5];
+        snprintf(buf,sizeof(buf),".%03d",frac);
+        int n = 4;
+        while (buf[n-1] == '0')
+            n--;
+        os.write(buf,n);
+    }
+}
+
+string PatchLine(const string& line,long long x,long long y)
+{
+    size_t comment = line.find(';');
+    string code = line.substr(0,comment);
+    istringstream is(code);
+    ostringstream os;
+    string word;
+    is >> word;
+    os << word << " X";
+    WriteMicron(os,x);
+    os << " Y";
+    WriteMicron(os,y);
+    while (is >> word)
+    {
+        if (word[0] != 'X' && word[0] != 'Y')
+            os << " " << word;
+    }
+    if (comment != string::npos)
+        os << line.substr(comment);
+    return os.str();
+}
+
+long long PatchApply(istream& gcode,istream& patch,ostream& os)
+{
+    PatchReader reader(patch);
+    long long nPatch = 0, x = 0, y = 0;
+    bool bPatch = reader.Next(nPatch,x,y);
+    long long nLine = 0, nPatched = 0;
+    string line;
+    while (!getline(gcode,line).fail())
+    {
+        ++nLine;
+        if (bPatch && nLine == nPatch)
+        {
+            bool bCR = line.size() && line[line.size()-1] == '\r';
+            if (bCR)
+                line.resize(line.size()-1);
+            os << PatchLine(line,x,y);
+            if (bCR)
+                os << '\r';
+            nPatched++;
+            bPatch = reader.Next(nPatch,x,y);
+        }
+        else
+            os << line;
+        os << '\n';
+    }
+    if (bPatch)
+        throw runtime_error("The patch does not match the g-code file");
+    return nPatched;
+}
@@ -0,0 +1,88 @@
+#ifndef _PATCH_H
+#define _PATCH_H
+
+/** @file */
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+/*
+ * Patch file format:
+ *
+ * Magic number (8 bytes), then one record per patched line:
+ * - Line number minus the line number of the previous record (starting at 0), as an unsigned varint
+ * - X and Y in microns, minus the ones of the previous record (starting at 0), as zigzag varints
+ *
+ * A null line delta ends the patch.
+ */
+
+/** @brief Writer of the positions of the moves changed by the processing */
+class PatchWriter
+{
+    public:
+        /** Writes the header of the patch */
+        PatchWriter(std::ostream& os);
+        /** Records the new position of a line
+         *
+         * @param nLine Line number, from 1, greater than the one of the previous record
+         * @param x,y New position in mm, rounded to the micron
+         */
+        void Record(long long nLine,double x,double y);
+        /** Writes the end of the patch */
+        void Close();
+        /** Number of records */
+        long long Count() const { return m_nRecords; }
+    private:
+        std::ostream& m_os;
+        long long m_nLine /** Line of the previous record */;
+        long long m_X /** X of the previous record, in microns */;
+        long long m_Y /** Y of the previous record, in microns */;
+        long long m_nRecords;
+};
+
+/** @brief Reader of a patch written by @ref PatchWriter */
+class PatchReader
+{
+    public:
+        /** Checks the header of the patch
+         *
+         * @throw std::runtime_error if it is not a patch file
+         */
+        PatchReader(std::istream& is);
+        /** Reads the next record
+         *
+         * @param nLine Line number, from 1
+         * @param x,y New position, in microns
+         * @return false at the end of the patch
+         */
+        bool Next(long long& nLine,long long& x,long long& y);
+    private:
+        std::istream& m_is;
+        long long m_nLine;
+        long long m_X;
+        long long m_Y;
+        bool m_bEnd;
+};
+
+/** Sets the X and Y parameters of a g-code move
+ *
+ * The X and Y parameters of the line are replaced, or added after the command if missing.
+ * The other parameters and the comment are kept.
+ *
+ * @param line G-Code line, without end of line
+ * @param x,y Position, in microns
+ */
+std::string PatchLine(const std::string& line,long long x,long long y);
+
+/** Writes the g-code file with the patched lines
+ *
+ * @param gcode Original g-code
+ * @param patch Patch of the g-code
+ * @param os Output, the g-code processed
+ * @return Number of patched lines
+ * @throw std::runtime_error if the patch does not match the g-code
+ */
+long long PatchApply(std::istream& gcode,std::istream& patch,std::ostream& os);
+
+#endif
@@ -0,0 +1,222 @@
+#include "PerfCounters.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <iomanip>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+using namespace std;
+
+/** Totals of a stage in a layer */
+struct PerfTotals
+{
+    uint64_t m_Values[PC_Count];
+    long long m_nVertices;
+    long long m_nCalls;
+
+    PerfTotals() :
+        m_nVertices(0),
+        m_nCalls(0)
+    {
+        memset(m_Values,0,sizeof(m_Values));
+    }
+};
+
+/** Names of the stages */
+static const char *StageNames[PS_Count] = { "Parse", "WideTurn", "WideCircle", "PushWall", "Fused", "Write" };
+
+static atomic<bool> g_bPerfEnabled(false);
+/** Thread whose counters are read */
+static thread::id g_PerfThread;
+static chrono::steady_clock::time_point g_PerfStart;
+/** Group leader, then the other counters, -1 if not opened */
+static int g_PerfFd[PC_Count] = { -1, -1, -1, -1, -1 };
+/** True if the counter is opened, in the order of the values read from the group */
+static bool g_bPerfOpened[PC_Count];
+/** Values recorded by all the stages */
+static uint64_t g_PerfRecorded[PC_Count];
+/** Totals of each stage, for each layer */
+static vector<vector<PerfTotals>> g_vPerfLayers;
+
+#ifdef __linux__
+/** Opens a hardware counter of the current thread, in user mode */
+static int PerfOpen(uint64_t config,int groupFd)
+{
+    perf_event_attr attr;
+    memset(&attr,0,sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = groupFd < 0 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(__NR_perf_event_open,&attr,0,-1,groupFd,0);
+}
+#endif
+
+static void PerfClose()
+{
+    for (int i=0;i<PC_Count;i++)
+    {
+        if (g_PerfFd[i] >= 0)
+            close(g_PerfFd[i]);
+        g_PerfFd[i] = -1;
+        g_bPerfOpened[i] = false;
+    }
+}
+
+bool PerfCountersStart()
+{
+    PerfClose();
+    memset(g_PerfRecorded,0,sizeof(g_PerfRecorded));
+    g_vPerfLayers.clear();
+    g_PerfThread = this_thread::get_id();
+#ifdef __linux__
+    static const uint64_t Configs[PC_Count] = { 0, PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+    // The other counters are optional, the cycles lead the group
+    g_PerfFd[PC_Cycles] = PerfOpen(Configs[PC_Cycles],-1);
+    if (g_PerfFd[PC_Cycles] >= 0)
+    {
+        g_bPerfOpened[PC_Cycles] = true;
+        for (int i=PC_Cycles+1;i<PC_Count;i++)
+        {
+            g_PerfFd[i] = PerfOpen(Configs[i],g_PerfFd[PC_Cycles]);
+            g_bPerfOpened[i] = g_PerfFd[i] >= 0;
+        }
+        ioctl(g_PerfFd[PC_Cycles],PERF_EVENT_IOC_RESET,PERF_IOC_FLAG_GROUP);
+        ioctl(g_PerfFd[PC_Cycles],PERF_EVENT_IOC_ENABLE,PERF_IOC_FLAG_GROUP);
+    }
+#endif
+    g_bPerfOpened[PC_Time] = true;
+    g_PerfStart = chrono::steady_clock::now();
+    g_bPerfEnabled = true;
+    return g_bPerfOpened[PC_Cycles];
+}
+
+void PerfCountersStop()
+{
+    g_bPerfEnabled = false;
+    // The opened flags stay set, they give the columns of the recorded values
+    for (int i=0;i<PC_Count;i++)
+    {
+        if (g_PerfFd[i] >= 0)
+            close(g_PerfFd[i]);
+        g_PerfFd[i] = -1;
+    }
+}
+
+bool PerfCountersEnabled()
+{
+    return g_bPerfEnabled.load(memory_order_relaxed);
+}
+
+void PerfCountersRead(PerfSample& start)
+{
+    memset(start.m_Values,0,sizeof(start.m_Values));
+    if (g_PerfFd[PC_Cycles] >= 0)
+    {
+        uint64_t buf[1 + PC_Count];
+        if (read(g_PerfFd[PC_Cycles],buf,sizeof(buf)) > 0)
+        {
+            // Values of the opened counters, in the order of their opening
+            uint64_t n = 1;
+            for (int i=PC_Cycles;i<PC_Count && n <= buf[0];i++)
+                if (g_bPerfOpened[i])
+                    start.m_Values[i] = buf[n++];
+        }
+    }
+    start.m_Values[PC_Time] = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - g_PerfStart).count();
+    memcpy(start.m_Recorded,g_PerfRecorded,sizeof(g_PerfRecorded));
+}
+
+void PerfCountersRecord(EPerfStage stage,const PerfSample& start,int nVertices,int nLayer)
+{
+    if (this_thread::get_id() != g_PerfThread || nLayer < 0)
+        return;
+    PerfSample end;
+    PerfCountersRead(end);
+    if (g_vPerfLayers.size() <= (size_t)nLayer)
+        g_vPerfLayers.resize(nLayer + 1,vector<PerfTotals>(PS_Count));
+    PerfTotals& t = g_vPerfLayers[nLayer][stage];
+    for (int i=0;i<PC_Count;i++)
+    {
+        // The stages recorded since the start are not counted twice
+        uint64_t total = end.m_Values[i] - start.m_Values[i];
+        uint64_t nested = g_PerfRecorded[i] - start.m_Recorded[i];
+        uint64_t v = total > nested ? total - nested : 0;
+        t.m_Values[i] += v;
+        g_PerfRecorded[i] += v;
+    }
+    t.m_nVertices += nVertices;
+    t.m_nCalls++;
+}
+
+/** Writes a counter, or - if it is not available */
+static void WriteCounter(ostream& os,const PerfTotals& t,EPerfCounter counter)
+{
+    os << "\t";
+    if (g_bPerfOpened[counter])
+        os << t.m_Values[counter];
+    else
+        os << "-";
+}
+
+void PerfCountersWrite(ostream& os)
+{
+    os << "layer\tstage\tcalls\tvertices\ttime_ms\tcycles\tinstructions\tcache_misses\tbranch_misses" << endl;
+    ios::fmtflags flags = os.flags();
+    streamsize precision = os.precision(3);
+    os << fixed;
+    for (size_t l=0;l<g_vPerfLayers.size();l++)
+    {
+        for (int s=0;s<PS_Count;s++)
+        {
+            const PerfTotals& t = g_vPerfLayers[l][s];
+            if (!t.m_nCalls)
+                continue;
+            os << l << "\t" << StageNames[s] << "\t" << t.m_nCalls << "\t" << t.m_nVertices
+                << "\t" << t.m_Values[PC_Time] / 1e6;
+            for (int i=PC_Cycles;i<PC_Count;i++)
+                WriteCounter(os,t,(EPerfCounter)i);
+            os << endl;
+        }
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void PerfCountersReport(ostream& os)
+{
+    if (!g_bPerfOpened[PC_Cycles])
+        os << "Performance counters: hardware counters not available, times only" << endl;
+    for (int s=0;s<PS_Count;s++)
+    {
+        PerfTotals t;
+        for (auto l = g_vPerfLayers.begin();l != g_vPerfLayers.end();l++)
+        {
+            for (int i=0;i<PC_Count;i++)
+                t.m_Values[i] += (*l)[s].m_Values[i];
+            t.m_nVertices += (*l)[s].m_nVertices;
+            t.m_nCalls += (*l)[s].m_nCalls;
+        }
+        if (!t.m_nCalls)
+            continue;
+        os << StageNames[s] << ": " << t.m_Values[PC_Time] / 1e6 << " ms, " << t.m_nVertices << " vertices";
+        if (g_bPerfOpened[PC_Instructions] && t.m_Values[PC_Cycles])
+            os << ", IPC " << (double)t.m_Values[PC_Instructions] / t.m_Values[PC_Cycles];
+        if (g_bPerfOpened[PC_CacheMisses] && t.m_nVertices)
+            os << ", " << (double)t.m_Values[PC_CacheMisses] / t.m_nVertices << " cache misses/vertex";
+        if (g_bPerfOpened[PC_BranchMisses] && t.m_nVertices)
+            os << ", " << (double)t.m_Values[PC_BranchMisses] / t.m_nVertices << " branch misses/vertex";
+        os << endl;
+    }
+}
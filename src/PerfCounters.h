@@ -0,0 +1,114 @@
+#ifndef _PERFCOUNTERS_H
+#define _PERFCOUNTERS_H
+
+/** @file */
+
+#include <ostream>
+#include <stdint.h>
+
+/** @brief Hardware performance counters of the processing stages, per layer
+ *
+ * The cycles, instructions, cache misses and branch misses of the thread which starts
+ * the counters are read with perf_event_open around each stage, and added to
+ * the totals of the stage in the layer. The counts of a stage exclude the stages
+ * recorded during it, for example the passes run while parsing in streaming mode.
+ *
+ * If the hardware counters are not available, for example in a container,
+ * only the times are recorded.
+ * When the counters are not started, recording a stage only tests a flag.
+ */
+
+/** Processing stages */
+enum EPerfStage
+{
+    PS_Parse /**< Parsing of the lines of a layer */,
+    PS_WideTurn /**< WideTurn pass */,
+    PS_WideCircle /**< WideCircle pass */,
+    PS_PushWall /**< PushWall pass */,
+    PS_Fused /**< Passes applied in a single traversal, with --fusedPasses */,
+    PS_Write /**< Writing of the processed steps */,
+    PS_Count /**< Number of stages */
+};
+
+/** Measured values, the time then the hardware counters */
+enum EPerfCounter
+{
+    PC_Time /**< Time in nanoseconds */,
+    PC_Cycles /**< CPU cycles */,
+    PC_Instructions /**< Instructions */,
+    PC_CacheMisses /**< Last level cache misses */,
+    PC_BranchMisses /**< Branch mispredictions */,
+    PC_Count /**< Number of values */
+};
+
+/** @brief Values read at the start of a stage */
+struct PerfSample
+{
+    uint64_t m_Values[PC_Count] /** Values read */;
+    uint64_t m_Recorded[PC_Count] /** Values recorded by all the stages when read */;
+};
+
+/** Opens the counters of the current thread, and clears the recorded values
+ *
+ * @return false if the hardware counters are not available, only the times are then recorded
+ */
+bool PerfCountersStart();
+
+/** Stops recording the stages and closes the counters, the recorded values are kept
+ * for @ref PerfCountersWrite and @ref PerfCountersReport
+ */
+void PerfCountersStop();
+
+/** True if the stages are recorded */
+bool PerfCountersEnabled();
+
+/** Reads the values at the start of a stage */
+void PerfCountersRead(PerfSample& start);
+
+/** Records a stage, ending now
+ *
+ * The stages of other threads than the one which started the counters are ignored.
+ *
+ * @param stage Stage
+ * @param start Values read at the start of the stage
+ * @param nVertices Number of g-code steps or points handled by the stage
+ * @param nLayer Layer number
+ */
+void PerfCountersRecord(EPerfStage stage,const PerfSample& start,int nVertices,int nLayer);
+
+/** Writes the values of each stage of each layer, as tab separated columns */
+void PerfCountersWrite(std::ostream& os);
+
+/** Writes the totals of each stage, with the IPC and the misses per vertex */
+void PerfCountersReport(std::ostream& os);
+
+/** @brief Stage recorded from its construction to its destruction */
+class PerfCounterScope
+{
+    public:
+        /** Starts a stage, with the parameters of @ref PerfCountersRecord */
+        PerfCounterScope(EPerfStage stage,int nVertices,int nLayer) :
+            m_Stage(stage),
+            m_nVertices(nVertices),
+            m_nLayer(nLayer),
+            m_bEnabled(PerfCountersEnabled())
+        {
+            if (m_bEnabled)
+                PerfCountersRead(m_Start);
+        }
+        ~PerfCounterScope()
+        {
+            if (m_bEnabled)
+                PerfCountersRecord(m_Stage,m_Start,m_nVertices,m_nLayer);
+        }
+    private:
+        PerfCounterScope(const PerfCounterScope&);
+        PerfCounterScope& operator=(const PerfCounterScope&);
+        EPerfStage m_Stage;
+        int m_nVertices;
+        int m_nLayer;
+        bool m_bEnabled;
+        PerfSample m_Start;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "SequenceGeometry.h"
+#include <math.h>
+#include <assert.h>
+
+using namespace std;
+
+/** Tolerance on the path length, to absorb the rounding errors of the prefix sums */
+static const double ArcEpsilon = 1e-6;
+
+SequenceGeometry::SequenceGeometry(const vector<pair<double,double>>& v,bool bClosed) :
+    m_Closed(bClosed)
+{
+    int sz = v.size();
+    int nSeg = bClosed ? sz : sz-1;
+    if (nSeg < 0)
+        nSeg = 0;
+    m_Dx.resize(nSeg);
+    m_Dy.resize(nSeg);
+    m_Length.resize(nSeg);
+    m_Arc.resize(nSeg+1);
+    m_Arc[0] = 0;
+    for (int i=0;i<nSeg;i++)
+    {
+        int j = i+1 < sz ? i+1 : 0;
+        m_Dx[i] = v[j].first - v[i].first;
+        m_Dy[i] = v[j].second - v[i].second;
+        m_Length[i] = sqrt(m_Dx[i]*m_Dx[i]+m_Dy[i]*m_Dy[i]);
+        m_Arc[i+1] = m_Arc[i] + m_Length[i];
+    }
+    /*
+     * The normal at point i is the perpendicular of the segment (i,i+1),
+     * or of the segment (i,i-1) for the last point, whatever the sequence is closed or not
+     */
+    m_Nx.resize(sz);
+    m_Ny.resize(sz);
+    for (int i=0;i<sz;i++)
+    {
+        double xperp,yperp,dperp;
+        if (i+1 < sz)
+        {
+            xperp = -m_Dy[i];
+            yperp = m_Dx[i];
+            dperp = m_Length[i];
+        }
+        else if (i > 0)
+        {
+            xperp = m_Dy[i-1];
+            yperp = -m_Dx[i-1];
+            dperp = m_Length[i-1];
+        }
+        else
+        {
+            xperp = yperp = dperp = 0;
+        }
+        m_Nx[i] = xperp / dperp;
+        m_Ny[i] = yperp / dperp;
+    }
+}
+
+double SequenceGeometry::ArcCirculaire(int i) const
+{
+    int sz = Size();
+    int q = i / sz;
+    int r = i % sz;
+    if (r < 0)
+    {
+        r += sz;
+        q--;
+    }
+    return q * m_Arc[sz] + m_Arc[r];
+}
+
+void SequenceGeometry::Triangles(const vector<pair<double,double>>& v,
+        double d1,
+        vector<int>& vA,
+        vector<int>& vC) const
+{
+    assert(v.size() == Size());
+    vA.assign(v.size(),-1);
+    vC.assign(v.size(),-1);
+    if (m_Closed)
+        TrianglesFermes(v,d1,vA,vC);
+    else
+        TrianglesOuverts(v,d1,vA,vC);
+}
+
+/** Square of the distance between two points */
+static inline double CarreDistance(const pair<double,double>& p1,const pair<double,double>& p2)
+{
+    return (p2.first-p1.first)*(p2.first-p1.first) + (p2.second-p1.second)*(p2.second-p1.second);
+}
+
+void SequenceGeometry::TrianglesOuverts(const vector<pair<double,double>>& v,
+        double d1,
+        vector<int>& vA,
+        vector<int>& vC) const
+{
+    int sz = v.size();
+    int s = 0; // Last point before i at a path length at least d1
+    int e = 1; // First point after i at a path length at least d1
+    for (int i=1;i+1<sz;i++)
+    {
+        while (s+1 <= i-1 && m_Arc[i] - m_Arc[s+1] >= d1 - ArcEpsilon)
+            s++;
+        int i1 = s;
+        while (CarreDistance(v[i1],v[i]) < d1*d1 && i1 > 0)
+            i1--;
+        vA[i] = i1;
+
+        if (e < i+1)
+            e = i+1;
+        while (e+1 < sz && m_Arc[e] - m_Arc[i] < d1 - ArcEpsilon)
+            e++;
+        int i3 = e;
+        while (CarreDistance(v[i],v[i3]) < d1*d1 && i3+1 < sz)
+            i3++;
+        vC[i] = i3;
+    }
+}
+
+void SequenceGeometry::TrianglesFermes(const vector<pair<double,double>>& v,
+        double d1,
+        vector<int>& vA,
+        vector<int>& vC) const
+{
+    /*
+     * The maximal shift is a third of the size of the sequence:
+     * For points evenly distributed, this is an equilateral triangle
+     */
+    int sz = v.size();
+    int decMax = sz/3;
+    int s = -decMax; // Unwrapped index of the first point of the triangle
+    int e = 1; // Unwrapped index of the third point of the triangle
+    for (int i=0;i<sz;i++)
+    {
+        double arc = ArcCirculaire(i);
+        if (s < i-decMax)
+            s = i-decMax;
+        while (s+1 <= i-1 && arc - ArcCirculaire(s+1) >= d1 - ArcEpsilon)
+            s++;
+        int dec12 = i-s;
+        int i1 = (i-dec12+sz)%sz;
+        while (CarreDistance(v[i1],v[i]) < d1*d1 && dec12 < decMax)
+        {
+            dec12++;
+            i1 = (i-dec12+sz)%sz;
+        }
+        vA[i] = i1;
+
+        if (e < i+1)
+            e = i+1;
+        while (e < i+decMax && ArcCirculaire(e) - arc < d1 - ArcEpsilon)
+            e++;
+        int dec23 = e-i;
+        int i3 = (i+dec23)%sz;
+        while (CarreDistance(v[i],v[i3]) < d1*d1 && dec23 < decMax)
+        {
+            dec23++;
+            i3 = (i+dec23)%sz;
+        }
+        vC[i] = i3;
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef _SEQUENCEGEOMETRY_H
+#define _SEQUENCEGEOMETRY_H
+
+/** @file */
+
+#include <vector>
+#include <utility>
+
+/** @brief Geometry cache of one extrusion sequence
+ *
+ * Segment vectors, unit normals and cumulated arc lengths are computed
+ * once per sequence, and shared by WideTurn, WideCircle and PushWall.
+ */
+class SequenceGeometry
+{
+    public:
+        /** Builds the cache
+         *
+         * @param v Original positions of the sequence
+         * @param bClosed True if the sequence is a closed loop: the last point
+         * is then connected to the first one
+         */
+        SequenceGeometry(const std::vector<std::pair<double,double>>& v,bool bClosed);
+
+        /** Number of points of the sequence */
+        int Size() const { return (int)m_Nx.size(); }
+        /** True if the sequence is a closed loop */
+        bool Closed() const { return m_Closed; }
+
+        /** Finds the triangle used to move each point of the sequence
+         *
+         * For each point B at index i, A at index vA[i] is the nearest preceding point
+         * at a distance at least d1 from B, and C at index vC[i] the nearest following one.
+         * If no such point exists, the search stops at the ends of an open sequence,
+         * or after a third of a closed sequence.
+         *
+         * The path length between two points is an upper bound of their distance,
+         * so the search starts at the first point at a path length d1, found with
+         * a two-pointer sweep. The result is the same as a point by point walk,
+         * but the cost is linear in the sequence size.
+         *
+         * For an open sequence, the first and the last points have no triangle,
+         * vA and vC are set to -1 at these indices.
+         *
+         * @param v Original positions, the same as given to the constructor
+         * @param d1 Minimal distance between the points of the triangle
+         * @param vA Indices of the first points of the triangles
+         * @param vC Indices of the third points of the triangles
+         */
+        void Triangles(const std::vector<std::pair<double,double>>& v,
+                double d1,
+                std::vector<int>& vA,
+                std::vector<int>& vC) const;
+
+        std::vector<double> m_Dx /** X component of the segment from point i to point i+1 (closing segment included for a closed loop) */;
+        std::vector<double> m_Dy /** Y component of the segment from point i to point i+1 */;
+        std::vector<double> m_Length /** Length of the segment from point i to point i+1 */;
+        std::vector<double> m_Arc /** Path length from the first point to point i, m_Arc[Size()] is the total length */;
+        std::vector<double> m_Nx /** X component of the unit normal of PushWall at point i */;
+        std::vector<double> m_Ny /** Y component of the unit normal of PushWall at point i */;
+
+    private:
+        bool m_Closed /** Closed loop */;
+        /** Path length of a closed loop at an index which may be outside [0:Size()-1] */
+        double ArcCirculaire(int i) const;
+        void TrianglesOuverts(const std::vector<std::pair<double,double>>& v,
+                double d1,
+                std::vector<int>& vA,
+                std::vector<int>& vC) const;
+        void TrianglesFermes(const std::vector<std::pair<double,double>>& v,
+                double d1,
+                std::vector<int>& vA,
+                std::vector<int>& vC) const;
+};
+
+#endif
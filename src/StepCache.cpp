@@ -0,0 +1,257 @@
+#include "StepCache.h"
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+/*
+ * Cache file format, in the native byte order:
+ *
+ * Header: magic (8 bytes), size, modification time in ns and hash of the g-code file,
+ * number of steps, size of the comments (64 bits each)
+ * Each step: X Y Z E F I J (double), fan speed (int32), length of the comment (uint32),
+ * offset of the comment (uint64), type and feature type (uint8), padding to 80 bytes
+ * Then the comments, without separators
+ */
+
+/** Magic number and version of the cache file */
+static const char CacheMagic[8] = {'P','S','S','T','E','P','0','1'};
+
+/** Header of the cache file */
+struct CacheHeader
+{
+    char m_Magic[8];
+    int64_t m_Size;
+    int64_t m_Mtime;
+    uint64_t m_Hash;
+    int64_t m_nSteps;
+    int64_t m_nCommentBytes;
+};
+
+/** Step of the cache file */
+struct StepRecord
+{
+    double m_X;
+    double m_Y;
+    double m_Z;
+    double m_E;
+    double m_F;
+    double m_I;
+    double m_J;
+    int32_t m_S;
+    uint32_t m_CommentLength;
+    uint64_t m_CommentOffset;
+    uint8_t m_Step;
+    uint8_t m_Feature;
+    uint8_t m_Padding[6];
+};
+
+static_assert(sizeof(CacheHeader) == 48 && sizeof(StepRecord) == 80,"Unexpected layout of the cache file");
+
+/** FNV-1a hash of a file content, by 64 bits words */
+static uint64_t Hash(const unsigned char *p,size_t n)
+{
+    uint64_t h = 14695981039346656037ULL;
+    size_t i = 0;
+    for (;i + sizeof(uint64_t) <= n;i += sizeof(uint64_t))
+    {
+        uint64_t w;
+        memcpy(&w,p + i,sizeof(w));
+        h ^= w;
+        h *= 1099511628211ULL;
+    }
+    for (;i < n;i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/** Size and modification time of a file */
+static bool FileStamp(const string& file,int64_t& size,int64_t& mtime)
+{
+    struct stat st;
+    if (stat(file.c_str(),&st) != 0)
+        return false;
+    size = st.st_size;
+    mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+/** Size, modification time and hash of a file */
+static bool FileStamp(const string& file,int64_t& size,int64_t& mtime,uint64_t& hash)
+{
+    if (!FileStamp(file,size,mtime))
+        return false;
+    hash = Hash(NULL,0);
+    if (!size)
+        return true;
+    int fd = open(file.c_str(),O_RDONLY);
+    if (fd < 0)
+        return false;
+    void *p = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    madvise(p,size,MADV_SEQUENTIAL);
+    hash = Hash((const unsigned char *)p,size);
+    munmap(p,size);
+    return true;
+}
+
+string StepCacheFile(const string& gcodeFile)
+{
+    return gcodeFile + ".steps";
+}
+
+StepCache::StepCache() :
+    m_Size(0),
+    m_Mtime(0),
+    m_Hash(0),
+    m_bStamp(false),
+    m_pMap(NULL),
+    m_MapSize(0),
+    m_nSteps(0),
+    m_pComments(NULL),
+    m_nRecorded(0)
+{
+}
+
+StepCache::~StepCache()
+{
+    Close();
+}
+
+void StepCache::Close()
+{
+    if (m_pMap)
+        munmap(m_pMap,m_MapSize);
+    m_pMap = NULL;
+    m_nSteps = 0;
+    if (m_Os.is_open())
+    {
+        // Recording not saved, after a parsing error
+        m_Os.close();
+        remove(m_TmpFile.c_str());
+    }
+}
+
+bool StepCache::Open(const string& gcodeFile)
+{
+    Close();
+    m_GCodeFile = gcodeFile;
+    m_bStamp = FileStamp(gcodeFile,m_Size,m_Mtime,m_Hash);
+    if (!m_bStamp)
+        return false;
+    string file = StepCacheFile(gcodeFile);
+    int fd = open(file.c_str(),O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd,&st) == 0 && st.st_size >= sizeof(CacheHeader))
+    {
+        m_MapSize = st.st_size;
+        m_pMap = mmap(NULL,m_MapSize,PROT_READ,MAP_PRIVATE,fd,0);
+        if (m_pMap == MAP_FAILED)
+            m_pMap = NULL;
+    }
+    if (fd >= 0)
+        close(fd);
+    if (m_pMap)
+    {
+        const CacheHeader *header = (const CacheHeader *)m_pMap;
+        if (memcmp(header->m_Magic,CacheMagic,sizeof(CacheMagic)) || header->m_Size != m_Size
+                || header->m_Mtime != m_Mtime || header->m_Hash != m_Hash
+                || header->m_nSteps < 0 || header->m_nCommentBytes < 0
+                || m_MapSize != sizeof(CacheHeader) + header->m_nSteps * sizeof(StepRecord) + header->m_nCommentBytes)
+        {
+            munmap(m_pMap,m_MapSize);
+            m_pMap = NULL;
+        }
+        else
+        {
+            m_nSteps = header->m_nSteps;
+            m_pComments = (const char *)m_pMap + sizeof(CacheHeader) + m_nSteps * sizeof(StepRecord);
+            madvise(m_pMap,m_MapSize,MADV_SEQUENTIAL);
+            return true;
+        }
+    }
+    // The parsed steps are recorded in a temporary file, with a header written by Save
+    m_TmpFile = file + "." + to_string(getpid()) + ".tmp";
+    m_Os.open(m_TmpFile.c_str(),ios::binary);
+    CacheHeader header;
+    memset(&header,0,sizeof(header));
+    m_Os.write((const char *)&header,sizeof(header));
+    m_Comments.clear();
+    m_nRecorded = 0;
+    return false;
+}
+
+void StepCache::Get(size_t i,GCodeStep& step) const
+{
+    const StepRecord& r = ((const StepRecord *)((const char *)m_pMap + sizeof(CacheHeader)))[i];
+    step.m_Step = (EGCodeStep)r.m_Step;
+    step.m_X = r.m_X;
+    step.m_Y = r.m_Y;
+    step.m_Z = r.m_Z;
+    step.m_E = r.m_E;
+    step.m_F = r.m_F;
+    step.m_I = r.m_I;
+    step.m_J = r.m_J;
+    step.m_S = r.m_S;
+    step.m_Feature = (EFeature)r.m_Feature;
+    step.m_Comment.assign(m_pComments + r.m_CommentOffset,r.m_CommentLength);
+}
+
+void StepCache::Record(const GCodeStep& step)
+{
+    if (!m_Os.is_open())
+        return;
+    StepRecord r;
+    memset(&r,0,sizeof(r));
+    r.m_X = step.m_X;
+    r.m_Y = step.m_Y;
+    r.m_Z = step.m_Z;
+    r.m_E = step.m_E;
+    r.m_F = step.m_F;
+    r.m_I = step.m_I;
+    r.m_J = step.m_J;
+    r.m_S = step.m_S;
+    r.m_CommentLength = step.m_Comment.size();
+    r.m_CommentOffset = m_Comments.size();
+    r.m_Step = step.m_Step;
+    r.m_Feature = step.m_Feature;
+    m_Comments += step.m_Comment;
+    m_Os.write((const char *)&r,sizeof(r));
+    m_nRecorded++;
+}
+
+bool StepCache::Save()
+{
+    if (!m_Os.is_open())
+        return false;
+    CacheHeader header;
+    memcpy(header.m_Magic,CacheMagic,sizeof(CacheMagic));
+    header.m_Size = m_Size;
+    header.m_Mtime = m_Mtime;
+    header.m_Hash = m_Hash;
+    header.m_nSteps = m_nRecorded;
+    header.m_nCommentBytes = m_Comments.size();
+    m_Os.write(m_Comments.data(),m_Comments.size());
+    m_Os.seekp(0);
+    m_Os.write((const char *)&header,sizeof(header));
+    m_Os.close();
+    m_Comments.clear();
+    // The g-code file must not have been changed while parsed
+    int64_t size,mtime;
+    if (m_Os.fail() || !FileStamp(m_GCodeFile,size,mtime) || size != m_Size || mtime != m_Mtime
+            || rename(m_TmpFile.c_str(),StepCacheFile(m_GCodeFile).c_str()) != 0)
+    {
+        remove(m_TmpFile.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef _STEPCACHE_H
+#define _STEPCACHE_H
+
+/** @file */
+
+#include <string>
+#include <fstream>
+#include <stdint.h>
+#include "GCodeStep.h"
+
+/** @brief Sidecar file of the parsed steps of a g-code file
+ *
+ * Tuning runs process the same input many times. The steps parsed by the first run
+ * are written next to the g-code file, and read by the next runs without parsing the text.
+ *
+ * The cache file is mapped in memory: a header, an array of fixed size records, one per step,
+ * then the comments. It is valid only for a g-code file with the same size,
+ * modification time and hash as when it was written.
+ * It is written to a temporary file renamed when complete, so concurrent runs
+ * never read a partial cache.
+ */
+class StepCache
+{
+    public:
+        StepCache();
+        ~StepCache();
+        /** Maps the cache file of a g-code file
+         *
+         * @param gcodeFile Name of the g-code file
+         * @return false if there is no cache file, or if the g-code file changed since the cache was written.
+         * The parsed steps may then be recorded with @ref Record.
+         */
+        bool Open(const std::string& gcodeFile);
+        /** True if the cache file is mapped */
+        bool Valid() const { return m_pMap != NULL; }
+        /** Number of steps of the mapped cache */
+        size_t Size() const { return m_nSteps; }
+        /** Reads a step of the mapped cache */
+        void Get(size_t i,GCodeStep& step) const;
+        /** Records a parsed step, after an unsuccessful @ref Open */
+        void Record(const GCodeStep& step);
+        /** Writes the recorded steps in the cache file
+         *
+         * @return false if the cache file could not be written, or if the g-code file changed while parsed
+         */
+        bool Save();
+    private:
+        StepCache(const StepCache&);
+        StepCache& operator=(const StepCache&);
+        void Close();
+        std::string m_GCodeFile /** Name of the g-code file */;
+        int64_t m_Size /** Size of the g-code file when opened */;
+        int64_t m_Mtime /** Modification time of the g-code file in ns when opened */;
+        uint64_t m_Hash /** Hash of the g-code file when opened */;
+        bool m_bStamp /** True if the g-code file was read when opened */;
+        void *m_pMap /** Mapped cache file, or NULL */;
+        size_t m_MapSize /** Size of the mapping */;
+        size_t m_nSteps /** Number of mapped steps */;
+        const char *m_pComments /** Comments of the mapped steps */;
+        std::string m_TmpFile /** Name of the temporary cache file */;
+        std::ofstream m_Os /** Temporary cache file, while recording */;
+        std::string m_Comments /** Comments of the recorded steps */;
+        int64_t m_nRecorded /** Number of recorded steps */;
+};
+
+/** Name of the step cache file of a g-code file */
+std::string StepCacheFile(const std::string& gcodeFile);
+
+#endif
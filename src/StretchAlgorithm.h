@@ -4,7 +4,10 @@
 /** @file */
 
 #include <vector>
+#include <deque>
 #include <memory>
+#include <ostream>
+#include <algorithm>
 #include "GCodeStep.h"
 
 /** GCode processing algorithm interface */
@@ -17,6 +20,29 @@ struct StretchAlgorithm
      * @param nLayer Layer number, starting at 1
      * @param v G-Code steps of the current layer */
     virtual void Process(int nLayer,std::vector<GCodeStep>& v) = 0;
+    /** G-Code transform of a layer received step by step
+     *
+     * Called after each new step of the layer, then once at the end of the layer.
+     * The default implementation processes the whole layer at its end.
+     *
+     * @param nLayer Layer number, starting at 1
+     * @param v G-Code steps of the current layer not written yet, the new step is the last one
+     * @param bEnd True at the end of the layer, without new step
+     * @return Number of steps at the beginning of v which are processed, and may be written
+     */
+    virtual size_t ProcessStream(int nLayer,std::deque<GCodeStep>& v,bool bEnd)
+    {
+        if (!bEnd)
+            return 0;
+        std::vector<GCodeStep> vLayer(v.begin(),v.end());
+        Process(nLayer,vLayer);
+        std::copy(vLayer.begin(),vLayer.end(),v.begin());
+        return v.size();
+    }
+    /** Writes the statistics of the processing, if any
+     *
+     * @param os Output stream */
+    virtual void Report(std::ostream& /*os*/) {}
 };
 
 class Params;
@@ -5,88 +5,392 @@
 #include <iostream>
 #include <assert.h>
 #include "microgeo.h"
+#include "SequenceGeometry.h"
+#include "ContactEngine.h"
+#include "Trace.h"
+#include "PerfCounters.h"
+#include "LayerReuse.h"
+#include "LayerSnapshot.h"
 #include <math.h>
 #include "params.h"
 #include <sstream>
-
-#define ENABLE_WIDETURN
-#define ENABLE_WIDECIRCLE
-#define ENABLE_PUSHWALL
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <unordered_set>
 
 using namespace std;
 
-/** Implémentation concrète du traitement d'une couche */
-class StretchAlgorithmImpl : public StretchAlgorithm
+/** Plastique déposé et compteurs d'une couche, ou d'un îlot de la couche
+ *
+ * Les îlots d'une couche sont traités en parallèle, chacun avec son propre contexte
+ */
+struct StretchDeposit
 {
-    public:
-        struct Segment
-        {
-            double x1;
-            double y1;
-            double x2;
-            double y2;
-            Segment() : x1(0),y1(0),x2(0),y2(0) {}
-            Segment(double x1_, double y1_, double x2_, double y2_) : x1(x1_),y1(y1_),x2(x2_),y2(y2_) {}
-        };
+    std::shared_ptr<ContactEngine> m_Contact /** Plastique déposé */;
+    std::shared_ptr<ContactEngine> m_ContactExact /** Moteur exact, pour compter les décisions différentes */;
+    long long m_nProbes /** Nombre de tests de contact comparés au moteur exact */;
+    long long m_nProbesDiff /** Nombre de tests de contact différents du moteur exact */;
+    long long m_nVertices /** Nombre de points comparés au moteur exact */;
+    long long m_nVerticesDiff /** Nombre de points corrigés différemment du moteur exact */;
+    long long m_nSegments /** Nombre de segments déposés avant simplification */;
+    long long m_nSegmentsKept /** Nombre de segments déposés après simplification */;
+    long long m_nUncorrected /** Nombre de séquences non corrigées à cause de leur type */;
+    long long m_nNoContact /** Nombre de séquences non enregistrées comme plastique déposé à cause de leur type */;
+    long long m_nDegraded /** Nombre de séquences traitées sans PushWall, le budget de la couche étant dépassé */;
+
+    StretchDeposit(const Params& params) :
+        m_Contact(ContactEngineFactory(params))
+    {
+        if (params.contactCheck && (params.contact != CM_Exact || params.simplify > 0))
+            m_ContactExact = ContactEngineFactory(params,true);
+        ClearCounters();
+    }
+    /** Compteurs d'une séquence traitée par anticipation, les moteurs étant partagés */
+    StretchDeposit()
+    {
+        ClearCounters();
+    }
+    /** Vide le plastique déposé, les positions à venir étant dans la boîte englobante */
+    void Clear(double xMin,double yMin,double xMax,double yMax)
+    {
+        m_Contact->Clear(xMin,yMin,xMax,yMax);
+        if (m_ContactExact)
+            m_ContactExact->Clear(xMin,yMin,xMax,yMax);
+    }
+    void ClearCounters()
+    {
+        m_nProbes = m_nProbesDiff = m_nVertices = m_nVerticesDiff = 0;
+        m_nSegments = m_nSegmentsKept = m_nUncorrected = m_nNoContact = m_nDegraded = 0;
+    }
+    /** Ajoute les compteurs d'un îlot */
+    void AddCounters(const StretchDeposit& d)
+    {
+        m_nProbes += d.m_nProbes;
+        m_nProbesDiff += d.m_nProbesDiff;
+        m_nVertices += d.m_nVertices;
+        m_nVerticesDiff += d.m_nVerticesDiff;
+        m_nSegments += d.m_nSegments;
+        m_nSegmentsKept += d.m_nSegmentsKept;
+        m_nUncorrected += d.m_nUncorrected;
+        m_nNoContact += d.m_nNoContact;
+        m_nDegraded += d.m_nDegraded;
+    }
+};
 
+/** Séquence traitée, avant l'enregistrement de son plastique et de ses nouvelles positions */
+struct SequenceWork
+{
+    vector<pair<double,double>> m_V /** Positions d'origine */;
+    vector<pair<double,double>> m_VTrans /** Nouvelles positions */;
+    bool m_bCorrect /** Les nouvelles positions sont écrites */;
+    bool m_bContact /** Le plastique de la séquence est enregistré */;
+    bool m_bWritten /** Les nouvelles positions sont déjà écrites dans les pas, par le noyau fusionné */;
+};
 
+/** Implémentation du traitement d'une couche
+ *
+ * Les passes appliquées à chaque séquence sont choisies par la classe dérivée
+ * @ref StretchAlgorithmPasses
+ */
+class StretchAlgorithmImpl : public StretchAlgorithm
+{
+    public:
         StretchAlgorithmImpl(const Params& params_) :
-            m_Params(params_) {}
+            m_Params(params_),
+            m_Deposit(params_),
+            m_nLayer(0),
+            m_nStreamLayer(0),
+            m_StreamE(0),
+            m_nStreamPending(0),
+            m_nReused(0),
+            m_nReuseDiff(0),
+            m_nIslandLayers(0),
+            m_nIslands(0),
+            m_nLayerSteps(0),
+            m_nLayerDone(0),
+            m_bDegraded(false),
+            m_nDegradedLayers(0),
+            m_nBudgetSteps(0),
+            m_nBudgetDone(0),
+            m_nSpeculated(0),
+            m_nConflicts(0),
+            m_nCaptured(0)
+        {
+            if (params_.reuse)
+                m_Reuse.reset(new LayerReuse(ReuseLayers));
+        }
         virtual ~StretchAlgorithmImpl() {}
         virtual void Process(int nLayer,std::vector<GCodeStep>& v);
-    private:
+        virtual size_t ProcessStream(int nLayer,std::deque<GCodeStep>& v,bool bEnd);
+        virtual void Report(std::ostream& os);
+    protected:
+        /** Applique les passes à une séquence
+         *
+         * @param v Positions d'origine
+         * @param vTrans Positions transformées
+         * @param geo Géométrie de la séquence
+         * @param deposit Plastique déposé avant la séquence
+         * @param bCorners Seulement les passes des virages, sans test de contact
+         * @param debugView Si non nul, traces d'affichage
+         */
+        virtual void ApplyPasses(vector<pair<double,double>>& v,
+                vector<pair<double,double>>& vTrans,
+                const SequenceGeometry& geo,
+                StretchDeposit& deposit,
+                bool bCorners,
+                GCodeDebugView *debugView) = 0;
         void PushWall(vector<pair<double,double>>& v,
                 vector<pair<double,double>>& vTrans,
+                const SequenceGeometry& geo,
+                StretchDeposit& deposit,
                 GCodeDebugView *debugView);
-        void Process(std::vector<GCodeStep>& v,GCodeDebugView *debugView);
-        const Params& m_Params /** Paramètres globaux */;
-        std::vector<Segment> m_Deposited /** Segments de plastique de la couche courante */;
-        void WorkOnSequence(vector<GCodeStep*>& v,GCodeDebugView *debugView);
-        string Dump(const GCodeStep& step);
-        double CarreDistance(const pair<double,double>& p1,const pair<double,double>& p2);
-        /** Corrige un segment aux indices i1 et i2 dans les deux tableaux v (mouvement désiré)
-         * et vTrans (mouvement corrigé)
+        /** Applique les passes à une séquence en un seul parcours, et écrit les nouvelles positions
+         *
+         * Le résultat est celui de @ref ApplyPasses suivi de l'écriture des positions
+         *
+         * @param vG Pas de la séquence
+         * @param v Positions d'origine
+         * @param geo Géométrie de la séquence
+         * @param deposit Plastique déposé avant la séquence
+         * @param bCorners Seulement les passes des virages, sans test de contact
          */
-        void CorrigeSegment(vector<pair<double,double>>& v,
-                vector<pair<double,double>>& vTrans,
-                int i1,
-                int i2,
-                GCodeDebugView *debugView,
-                double d2,
-                double d3,
-                double d4);
+        virtual void FusedPasses(vector<GCodeStep*>& vG,
+                const vector<pair<double,double>>& v,
+                const SequenceGeometry& geo,
+                StretchDeposit& deposit,
+                bool bCorners) = 0;
+        /** Noyau de @ref FusedPasses pour une combinaison de passes
+         *
+         * @tparam Passes Combinaison de @ref EPass
+         */
+        template<unsigned Passes>
+        void FusedKernel(vector<GCodeStep*>& vG,
+                const vector<pair<double,double>>& v,
+                const SequenceGeometry& geo,
+                StretchDeposit& deposit,
+                bool bCorners);
+        double CarreDistance(const pair<double,double>& p1,const pair<double,double>& p2);
         /** La séquence semble être linéaire
          *
          * @param v Positions d'origine
          * @param vTrans Positions transformées
+         * @param geo Géométrie de la séquence
          * @param debugView Si non nul, traces d'affichage
          */
         void WideTurn(vector<pair<double,double>>& v,
                vector<pair<double,double>>& vTrans,
+               const SequenceGeometry& geo,
                GCodeDebugView *debugView);
         /** La séquence semble être circulaire, il est possible de mieux calculer les virages
          *
          * @param v Positions d'origine
          * @param vTrans Positions transformées
+         * @param geo Géométrie de la séquence
          * @param debugView Si non nul, traces d'affichage
          */
         void WideCircle(vector<pair<double,double>>& v,
                vector<pair<double,double>>& vTrans,
+               const SequenceGeometry& geo,
                GCodeDebugView *debugView);
-        /** Conversion de l'indice i passé en paramètre pour être dans l'intervalle [0:sz-1] */
-        static int IndiceCirculaire(int i,int sz);
+    private:
+        void Process(std::vector<GCodeStep>& v,GCodeDebugView *debugView);
+        /** Traitement des séquences d'une couche par îlots indépendants, en parallèle */
+        void ProcessIslands(vector<vector<GCodeStep*>>& vSeq);
+        /** Traitement de séquences dans leur ordre, par fenêtres traitées en parallèle si possible */
+        void ProcessSequences(vector<vector<GCodeStep*>>& vSeq,StretchDeposit& deposit);
+        const Params& m_Params /** Paramètres globaux */;
+        StretchDeposit m_Deposit /** Plastique déposé dans la couche courante, et compteurs de toutes les couches */;
+        vector<unique_ptr<StretchDeposit>> m_vIslands /** Plastique déposé dans chaque îlot de la couche courante */;
+        int m_nLayer /** Numéro de la couche en cours de traitement */;
+        int m_nStreamLayer /** Couche en cours de traitement en flux, ou 0 */;
+        double m_StreamE /** Extrusion du dernier pas reçu en flux */;
+        vector<GCodeStep*> m_vStreamPos /** Séquence en cours en flux */;
+        vector<pair<GCodeStep*,pair<double,double>>> m_vArcEnds /** Extrémités des arcs de la couche courante et leurs positions d'origine */;
+        /** Garde la position d'origine du départ ou de l'arrivée d'un arc */
+        void KeepArcEnd(GCodeStep *p);
+        /** Remet les extrémités des arcs à leurs positions d'origine */
+        void RestoreArcEnds();
+        size_t m_nStreamPending /** Nombre de pas reçus depuis le début de la séquence en cours */;
+        /** Nombre de couches traitées gardées pour être rejouées */
+        static const int ReuseLayers = 4;
+        std::unique_ptr<LayerReuse> m_Reuse /** Couches traitées rejouées sur les couches de même géométrie */;
+        long long m_nReused /** Nombre de couches rejouées */;
+        long long m_nReuseDiff /** Nombre de couches rejouées différentes du traitement, avec vérification */;
+        long long m_nIslandLayers /** Nombre de couches découpées en plusieurs îlots */;
+        long long m_nIslands /** Nombre d'îlots de ces couches */;
+        chrono::steady_clock::time_point m_LayerStart /** Début du traitement de la couche courante */;
+        size_t m_nLayerSteps /** Nombre de pas des séquences traitées de la couche courante si son budget est surveillé, ou 0 */;
+        std::atomic<size_t> m_nLayerDone /** Nombre de pas des séquences traitées dans la couche courante */;
+        std::atomic<bool> m_bDegraded /** Le reste de la couche courante est traité sans PushWall */;
+        long long m_nDegradedLayers /** Nombre de couches ayant dépassé leur budget */;
+        long long m_nBudgetSteps /** Nombre de pas des projections des couches dont le budget est surveillé */;
+        long long m_nBudgetDone /** Nombre de pas traités de ces couches */;
+        vector<StretchDeposit> m_vSpeculative /** Compteurs des séquences d'une fenêtre traitées par anticipation */;
+        long long m_nSpeculated /** Nombre de séquences des fenêtres traitées par anticipation */;
+        long long m_nConflicts /** Nombre de ces séquences traitées à nouveau après un conflit */;
+        int m_nCaptured /** Nombre de couches lentes enregistrées */;
+        /** Traitement d'une couche, enregistrée si le traitement est plus long que le seuil */
+        void ProcessCapture(std::vector<GCodeStep>& v);
+        /** Traitement d'une couche, ou rejeu d'une couche de même géométrie */
+        void ProcessReuse(std::vector<GCodeStep>& v);
+        /** Type de la séquence, parmi 1 << @ref EFeature
+         *
+         * Le type de la séquence est celui de son premier déplacement avec extrusion,
+         * le premier point étant la fin du déplacement précédent
+         */
+        unsigned SequenceFeature(const vector<GCodeStep*>& vG) const { return 1u << vG[1]->m_Feature; }
+        /** La séquence est corrigée ou enregistrée comme plastique déposé, selon son type */
+        bool Processed(const vector<GCodeStep*>& vG) const
+        {
+            return ((m_Params.correctTypes | m_Params.contactTypes) & SequenceFeature(vG)) != 0;
+        }
+        /** Le traitement de la couche courante dépasserait son budget
+         *
+         * @param vG Séquence à traiter, annotée si c'est la première traitée sans PushWall
+         */
+        bool OverBudget(vector<GCodeStep*>& vG);
+        void WorkOnSequence(vector<GCodeStep*>& v,StretchDeposit& deposit,GCodeDebugView *debugView);
+        /** Applique les passes à une séquence, sans modifier le plastique déposé ni les pas
+         *
+         * @return false si la séquence n'est ni corrigée, ni enregistrée
+         */
+        bool ComputeSequence(vector<GCodeStep*>& vG,StretchDeposit& deposit,SequenceWork& work,GCodeDebugView *debugView);
+        /** Enregistre le plastique déposé par une séquence, et écrit ses nouvelles positions */
+        void CommitSequence(vector<GCodeStep*>& vG,StretchDeposit& deposit,SequenceWork& work,GCodeDebugView *debugView);
+        string Dump(const GCodeStep& step);
 };
 
-int StretchAlgorithmImpl::IndiceCirculaire(int i,int sz)
+/*
+ * Mêmes calculs que WideTurn ou WideCircle, puis PushWall, pour chaque point:
+ * le déplacement d'un point ne dépend que des positions d'origine, de sa position
+ * transformée et du plastique déposé avant la séquence. Chaque point est lu,
+ * déplacé et écrit une seule fois, sans tableau des positions transformées.
+ */
+template<unsigned Passes>
+void StretchAlgorithmImpl::FusedKernel(vector<GCodeStep*>& vG,
+        const vector<pair<double,double>>& v,
+        const SequenceGeometry& geo,
+        StretchDeposit& deposit,
+        bool bCorners)
 {
-    while (i < 0)
-        i += sz;
-    while (i >= sz)
-        i -= sz;
-    assert(i >= 0 && i < sz);
-    return i;
+    PerfCounterScope counters(PS_Fused,v.size(),m_nLayer);
+    const double d1 = 0.5;
+    const double d2 = (double)m_Params.wallWidth / 1000.0 / 2.0;
+    const double d4 = (double)m_Params.stretch / 1000.0;
+    const bool bClosed = geo.Closed();
+    const bool bCorner = bClosed ? (Passes & PASS_WideCircle) != 0 : (Passes & PASS_WideTurn) != 0;
+    const bool bPushWall = (Passes & PASS_PushWall) && !bCorners;
+    vector<int> vA,vC;
+    if (bCorner)
+        geo.Triangles(v,d1,vA,vC);
+    const int n = v.size();
+    for (int i=0;i<n;i++)
+    {
+        double x = v[i].first;
+        double y = v[i].second;
+        if (bCorner && (bClosed || (i > 0 && i+1 < n)))
+        {
+            double xp,yp;
+            ExterieurVirage(v[vA[i]].first,v[vA[i]].second,
+                    v[i].first,v[i].second,
+                    v[vC[i]].first,v[vC[i]].second,
+                    d4,
+                    xp,yp
+                    );
+            assert(xp >= 0 && xp < 200);
+            assert(yp >= 0 && yp < 200);
+            x = floor(xp*1000.0 + 0.5)/1000.0;
+            y = floor(yp*1000.0 + 0.5)/1000.0;
+        }
+        if (bPushWall)
+        {
+            double xperp = geo.m_Nx[i];
+            double yperp = geo.m_Ny[i];
+            double xp1 = v[i].first + xperp * d2;
+            double yp1 = v[i].second + yperp * d2;
+            double xp2 = v[i].first - xperp * d2;
+            double yp2 = v[i].second - yperp * d2;
+            bool toucheplus = deposit.m_Contact->Touches(xp1,yp1);
+            bool touchemoins = deposit.m_Contact->Touches(xp2,yp2);
+            if (deposit.m_ContactExact)
+            {
+                bool touchePlusExact = deposit.m_ContactExact->Touches(xp1,yp1);
+                bool toucheMoinsExact = deposit.m_ContactExact->Touches(xp2,yp2);
+                deposit.m_nProbes += 2;
+                deposit.m_nProbesDiff += (touchePlusExact != toucheplus) + (toucheMoinsExact != touchemoins);
+                deposit.m_nVertices++;
+                if (touchePlusExact != toucheplus || toucheMoinsExact != touchemoins)
+                    deposit.m_nVerticesDiff++;
+            }
+            if (toucheplus && touchemoins)
+            {
+                x = v[i].first;
+                y = v[i].second;
+            }
+            else if (toucheplus || touchemoins)
+            {
+                double sign = toucheplus ? 1.0 : -1.0;
+                double xp = x + sign * xperp * d4;
+                double yp = y + sign * yperp * d4;
+                assert(xp >= 0 && xp < 200);
+                assert(yp >= 0 && yp < 200);
+                x = floor(xp*1000.0 + 0.5)/1000.0;
+                y = floor(yp*1000.0 + 0.5)/1000.0;
+            }
+        }
+        vG[i]->m_X = x;
+        vG[i]->m_Y = y;
+        assert(x >= 0 && x < 200);
+        assert(y >= 0 && y < 200);
+    }
 }
 
+/** Spécialisation du traitement pour une combinaison de passes
+ *
+ * Les passes désactivées sont éliminées à la compilation. Les tests de contact
+ * restent des appels virtuels du moteur choisi, deux par point.
+ *
+ * @tparam Passes Combinaison de @ref EPass
+ */
+template<unsigned Passes>
+class StretchAlgorithmPasses : public StretchAlgorithmImpl
+{
+    public:
+        StretchAlgorithmPasses(const Params& params_) :
+            StretchAlgorithmImpl(params_) {}
+    protected:
+        virtual void ApplyPasses(vector<pair<double,double>>& v,
+                vector<pair<double,double>>& vTrans,
+                const SequenceGeometry& geo,
+                StretchDeposit& deposit,
+                bool bCorners,
+                GCodeDebugView *debugView)
+        {
+            if (geo.Closed())
+            {
+                if (Passes & PASS_WideCircle)
+                    WideCircle(v,vTrans,geo,debugView);
+            }
+            else
+            {
+                if (Passes & PASS_WideTurn)
+                    WideTurn(v,vTrans,geo,debugView);
+            }
+            if ((Passes & PASS_PushWall) && !bCorners)
+                PushWall(v,vTrans,geo,deposit,debugView);
+        }
+        virtual void FusedPasses(vector<GCodeStep*>& vG,
+                const vector<pair<double,double>>& v,
+                const SequenceGeometry& geo,
+                StretchDeposit& deposit,
+                bool bCorners)
+        {
+            FusedKernel<Passes>(vG,v,geo,deposit,bCorners);
+        }
+};
+
 double StretchAlgorithmImpl::CarreDistance(const pair<double,double>& p1,const pair<double,double>& p2)
 {
     return (p2.first-p1.first)*(p2.first-p1.first) + (p2.second-p1.second)*(p2.second-p1.second);
@@ -131,87 +435,19 @@ string StretchAlgorithmImpl::Dump(const GCodeStep& step)
     {
         ss << "GC_DefinePos";
     }
-    return ss.str();
-}
-
-void StretchAlgorithmImpl::CorrigeSegment(vector<pair<double,double>>& v,
-        vector<pair<double,double>>& vTrans,
-        int i1,
-        int i2,
-        GCodeDebugView *debugView,
-        double d2,
-        double d3,
-        double d4)
-{
-    /*
-     * Je n'ai qu'un segment. S'il n'y a du plastique que d'un seul côté,
-     * je décale le segment pour "pousser le mur"
-     */
-    //double xm = (v[i1].first + v[i2].first) / 2.0;
-    double xm = v[i1].first;
-    //double ym = (v[i1].second + v[i2].second) / 2.0;
-    double ym = v[i1].second;
-    //if (debugView)
-    //    debugView->Point(xm,ym,0);
-    double xperp = -(v[i2].second - v[i1].second); // Coordonnées de la perpendiculaire au segment
-    double yperp = (v[i2].first - v[i1].first);
-    double dperp = sqrt(xperp*xperp+yperp*yperp); // Norme de la perpendiculaire
-    xperp /= dperp;
-    yperp /= dperp;
-    double xp1 = xm + xperp * d2;
-    double yp1 = ym + yperp * d2;
-    //if (debugView)
-    //    debugView->Point(xp1,yp1,0);
-    bool toucheplus = false;
-    for (auto j=m_Deposited.begin();!toucheplus && j!=m_Deposited.end();j++)
-    {
-        if (CarreDistanceSegmentPoint(xp1,yp1,j->x1,j->y1,j->x2,j->y2) <= (d3/2.0)*(d3/2.0))
-            toucheplus = true;
-    }
-    double xp2 = xm - xperp * d2;
-    double yp2 = ym - yperp * d2;
-    //if (debugView)
-    //    debugView->Point(xp2,yp2,0);
-    bool touchemoins = false;
-    for (auto j=m_Deposited.begin();!touchemoins && j!=m_Deposited.end();j++)
-    {
-        if (CarreDistanceSegmentPoint(xp2,yp2,j->x1,j->y1,j->x2,j->y2) <= (d3/2.0)*(d3/2.0))
-            touchemoins = true;
-    }
-    /*
-     * Je décale vTrans, pour que l'effet soit cumulatif
-     */
-    if (toucheplus && !touchemoins)
-    {
-        double xp = vTrans[i1].first + xperp * d4;
-        double yp = vTrans[i1].second + yperp * d4;
-        assert(xp >= 0 && xp < 200);
-        assert(yp >= 0 && yp < 200);
-        vTrans[i1].first = floor(xp*1000.0 + 0.5)/1000.0;
-        vTrans[i1].second = floor(yp*1000.0 + 0.5)/1000.0;
-    }
-    if (touchemoins && !toucheplus)
-    {
-        double xp = vTrans[i1].first - xperp * d4;
-        double yp = vTrans[i1].second - yperp * d4;
-        assert(xp >= 0 && xp < 200);
-        assert(yp >= 0 && yp < 200);
-        vTrans[i1].first = floor(xp*1000.0 + 0.5)/1000.0;
-        vTrans[i1].second = floor(yp*1000.0 + 0.5)/1000.0;
-    }
-    if (toucheplus && touchemoins)
+    else if (step.m_Step==GC_ArcCW || step.m_Step==GC_ArcCCW)
     {
-        // Vu qu'on est entouré de murs, autant rester sages
-        // J'annule toutes les transformations
-        vTrans[i1] = v[i1];
+        ss << (step.m_Step==GC_ArcCW ? "GC_ArcCW" : "GC_ArcCCW") << " X=" << step.m_X << " Y=" << step.m_Y << " E=" << step.m_E;
     }
+    return ss.str();
 }
 
 void StretchAlgorithmImpl::WideTurn(vector<pair<double,double>>& v,
         vector<pair<double,double>>& vTrans,
+        const SequenceGeometry& geo,
         GCodeDebugView *debugView)
 {
-#ifdef ENABLE_WIDETURN
+    PerfCounterScope counters(PS_WideTurn,v.size(),m_nLayer);
     /*
     if (debugView)
     {
@@ -223,6 +459,8 @@ void StretchAlgorithmImpl::WideTurn(vector<pair<double,double>>& v,
     const double d2 = /*0.7 / 2.0*/ (double)m_Params.wallWidth / 1000.0 / 2.0;
     const double d3 = /*0.8*/ (double)m_Params.nozzleDiameter / 1000.0;
     const double d4 = /*0.17*/(double)m_Params.stretch / 1000.0;
+    vector<int> vA,vC;
+    geo.Triangles(v,d1,vA,vC);
     for (int i=1;i+1<v.size();i++)
     {
         /*
@@ -244,13 +482,8 @@ void StretchAlgorithmImpl::WideTurn(vector<pair<double,double>>& v,
          * Maintenant, je décale d'office, et le traitement des segments peut
          * me remettre au point de départ
          */
-        int i1 = i-1;
-        double d;
-        while ((d = CarreDistance(v[i1],v[i])) < d1*d1 && i1 > 0)
-            i1--;
-        int i3 = i+1;
-        while ((d = CarreDistance(v[i],v[i3])) < d1*d1 && i3+1 < v.size())
-            i3++;
+        int i1 = vA[i];
+        int i3 = vC[i];
         /*
          * Le triangle est constitué des points aux indices i1, i et i3
          */
@@ -270,14 +503,14 @@ void StretchAlgorithmImpl::WideTurn(vector<pair<double,double>>& v,
         //    debugView->Point(xp,yp,0);
 
     }
-#endif
 }
 
 void StretchAlgorithmImpl::WideCircle(vector<pair<double,double>>& v,
         vector<pair<double,double>>& vTrans,
+        const SequenceGeometry& geo,
         GCodeDebugView *debugView)
 {
-#ifdef ENABLE_WIDECIRCLE
+    PerfCounterScope counters(PS_WideCircle,v.size(),m_nLayer);
     /*
     if (debugView)
     {
@@ -296,7 +529,8 @@ void StretchAlgorithmImpl::WideCircle(vector<pair<double,double>>& v,
      * mais le tiers de la taille du vecteur: Pour une répartition homogène
      * de tous les points, cela fait un triangle équilatéral
      */
-    int decMax = v.size()/3;
+    vector<int> vA,vC;
+    geo.Triangles(v,d1,vA,vC);
     for (int i=0;i<v.size();i++)
     {
         /*
@@ -318,21 +552,8 @@ void StretchAlgorithmImpl::WideCircle(vector<pair<double,double>>& v,
          * Maintenant, je décale d'office, et le traitement des segments peut
          * me remettre au point de départ
          */
-        int dec12 = 1; // Décalage en indice du premier point du triangle par rapport au deuxième
-        int i1 = IndiceCirculaire(i-dec12,v.size());
-        double d;
-        while ((d = CarreDistance(v[i1],v[i])) < d1*d1 && dec12 < decMax)
-        {
-            dec12++;
-            i1 = IndiceCirculaire(i-dec12,v.size());
-        }
-        int dec23 = 1; // Décalage en indice du deuxième point du triangle par rapport au troisième
-        int i3 = IndiceCirculaire(i+dec23,v.size());
-        while ((d = CarreDistance(v[i],v[i3])) < d1*d1 && dec23 < decMax)
-        {
-            dec23++;
-            i3 = IndiceCirculaire(i+dec23,v.size());
-        }
+        int i1 = vA[i];
+        int i3 = vC[i];
         /*
          * Le triangle est constitué des points aux indices i1, i et i3
          */
@@ -354,23 +575,20 @@ void StretchAlgorithmImpl::WideCircle(vector<pair<double,double>>& v,
             */
 
     }
-#endif
 }
 
 void StretchAlgorithmImpl::PushWall(vector<pair<double,double>>& v,
         vector<pair<double,double>>& vTrans,
+        const SequenceGeometry& geo,
+        StretchDeposit& deposit,
         GCodeDebugView *debugView)
 {
-#ifdef ENABLE_PUSHWALL
+    PerfCounterScope counters(PS_PushWall,v.size(),m_nLayer);
     const double d2 = /*0.7 / 2.0*/ (double)m_Params.wallWidth / 1000.0 / 2.0;
-    const double d3 = /*0.8*/ (double)m_Params.nozzleDiameter / 1000.0;
     const double d4 = /*0.17*/(double)m_Params.stretch / 1000.0;
      for (int i=0;i<v.size();i++)
     {
         int i1 = i;
-        int i2 = i+1;
-        if (i2 == v.size())
-            i2 = i-1;
         /*
          * Je n'ai qu'un segment. S'il n'y a du plastique que d'un seul côté,
          * je décale le segment pour "pousser le mur"
@@ -381,30 +599,27 @@ void StretchAlgorithmImpl::PushWall(vector<pair<double,double>>& v,
         double ym = v[i1].second;
         //if (debugView)
         //    debugView->Point(xm,ym,0);
-        double xperp = -(v[i2].second - v[i1].second); // Coordonnées de la perpendiculaire au segment
-        double yperp = (v[i2].first - v[i1].first);
-        double dperp = sqrt(xperp*xperp+yperp*yperp); // Norme de la perpendiculaire
-        xperp /= dperp;
-        yperp /= dperp;
+        double xperp = geo.m_Nx[i1]; // Perpendiculaire unitaire au segment
+        double yperp = geo.m_Ny[i1];
         double xp1 = xm + xperp * d2;
         double yp1 = ym + yperp * d2;
         //if (debugView)
         //    debugView->Point(xp1,yp1,0);
-        bool toucheplus = false;
-        for (auto j=m_Deposited.begin();!toucheplus && j!=m_Deposited.end();j++)
-        {
-            if (CarreDistanceSegmentPoint(xp1,yp1,j->x1,j->y1,j->x2,j->y2) <= (d3/2.0)*(d3/2.0))
-                toucheplus = true;
-        }
+        bool toucheplus = deposit.m_Contact->Touches(xp1,yp1);
         double xp2 = xm - xperp * d2;
         double yp2 = ym - yperp * d2;
         //if (debugView)
         //    debugView->Point(xp2,yp2,0);
-        bool touchemoins = false;
-        for (auto j=m_Deposited.begin();!touchemoins && j!=m_Deposited.end();j++)
+        bool touchemoins = deposit.m_Contact->Touches(xp2,yp2);
+        if (deposit.m_ContactExact)
         {
-            if (CarreDistanceSegmentPoint(xp2,yp2,j->x1,j->y1,j->x2,j->y2) <= (d3/2.0)*(d3/2.0))
-                touchemoins = true;
+            bool touchePlusExact = deposit.m_ContactExact->Touches(xp1,yp1);
+            bool toucheMoinsExact = deposit.m_ContactExact->Touches(xp2,yp2);
+            deposit.m_nProbes += 2;
+            deposit.m_nProbesDiff += (touchePlusExact != toucheplus) + (toucheMoinsExact != touchemoins);
+            deposit.m_nVertices++;
+            if (touchePlusExact != toucheplus || toucheMoinsExact != touchemoins)
+                deposit.m_nVerticesDiff++;
         }
         /*
          * Je décale vTrans, pour que l'effet soit cumulatif
@@ -434,34 +649,118 @@ void StretchAlgorithmImpl::PushWall(vector<pair<double,double>>& v,
             vTrans[i1] = v[i1];
         }
     }
-#endif
 }
 
 
-void StretchAlgorithmImpl::WorkOnSequence(vector<GCodeStep*>& vG,GCodeDebugView *debugView)
+/*
+ * La durée de la couche est extrapolée linéairement à partir des pas des séquences déjà traitées.
+ * La première séquence dégradée porte un commentaire dans le g-code produit.
+ */
+bool StretchAlgorithmImpl::OverBudget(vector<GCodeStep*>& vG)
 {
-    vector<pair<double,double>> v; // Original positions, where material should be after cooling
-    vector<pair<double,double>> vTrans; // New positions
+    if (!m_nLayerSteps)
+        return false;
+    if (m_bDegraded)
+        return true;
+    size_t nDone = m_nLayerDone;
+    if (!nDone)
+        return false;
+    double ms = chrono::duration<double,milli>(chrono::steady_clock::now() - m_LayerStart).count();
+    if (ms * m_nLayerSteps / nDone <= m_Params.layerBudgetMs)
+        return false;
+    if (!m_bDegraded.exchange(true))
+    {
+        string& comment = vG[0]->m_Comment;
+        comment += comment.empty() ? "" : " ";
+        comment += "Layer budget exceeded, PushWall disabled for the rest of the layer";
+    }
+    return true;
+}
+
+void StretchAlgorithmImpl::WorkOnSequence(vector<GCodeStep*>& vG,StretchDeposit& deposit,GCodeDebugView *debugView)
+{
+    // Only long sequences are traced, to keep the trace small
+    TraceSpan span(vG.size() >= m_Params.traceMinSteps ? "WorkOnSequence" : NULL,vG.size(),m_nLayer);
+    SequenceWork work;
+    if (ComputeSequence(vG,deposit,work,debugView))
+        CommitSequence(vG,deposit,work,debugView);
+}
+
+bool StretchAlgorithmImpl::ComputeSequence(vector<GCodeStep*>& vG,StretchDeposit& deposit,SequenceWork& work,GCodeDebugView *debugView)
+{
+    unsigned feature = SequenceFeature(vG);
+    work.m_bCorrect = (m_Params.correctTypes & feature) != 0;
+    work.m_bContact = (m_Params.contactTypes & feature) != 0;
+    if (!work.m_bCorrect)
+        deposit.m_nUncorrected++;
+    if (!work.m_bContact)
+        deposit.m_nNoContact++;
+    if (!work.m_bCorrect && !work.m_bContact)
+        return false;
+    /*
+     * Hors budget, le plastique déposé n'est plus enregistré: PushWall n'est plus appliqué
+     * dans le reste de la couche
+     */
+    bool bCorners = OverBudget(vG);
+    m_nLayerDone += vG.size();
+    if (bCorners)
+    {
+        deposit.m_nDegraded++;
+        work.m_bContact = false;
+    }
+    vector<pair<double,double>>& v = work.m_V; // Original positions, where material should be after cooling
+    vector<pair<double,double>>& vTrans = work.m_VTrans; // New positions
+    // Le noyau fusionné écrit directement les nouvelles positions, sans vTrans
+    work.m_bWritten = work.m_bCorrect && m_Params.fusedPasses && !debugView;
     for (auto i = vG.begin();i!=vG.end();i++)
     {
-        vTrans.push_back(pair<double,double>((*i)->m_X,(*i)->m_Y));
+        if (!work.m_bWritten)
+            vTrans.push_back(pair<double,double>((*i)->m_X,(*i)->m_Y));
         v.push_back(pair<double,double>((*i)->m_X,(*i)->m_Y));
     }
     if (debugView)
         debugView->Sequences(v,0,(double)m_Params.wallWidth / 1000.0);
-    if (v.size() > 2 && CarreDistance(v[0],v[v.size()-1]) < 0.3*0.3) // TODO Un paramètre pour la distance minimale?
-        WideCircle(v,vTrans,debugView);
-    else
-        WideTurn(v,vTrans,debugView);
-    PushWall(v,vTrans,debugView);
-    for (int i=0;i+1<v.size();i++)
+    if (work.m_bCorrect)
+    {
+        bool bClosed = v.size() > 2 && CarreDistance(v[0],v[v.size()-1]) < 0.3*0.3; // TODO Un paramètre pour la distance minimale?
+        SequenceGeometry geo(v,bClosed);
+        if (work.m_bWritten)
+            FusedPasses(vG,v,geo,deposit,bCorners);
+        else
+            ApplyPasses(v,vTrans,geo,deposit,bCorners,debugView);
+    }
+    return true;
+}
+
+void StretchAlgorithmImpl::CommitSequence(vector<GCodeStep*>& vG,StretchDeposit& deposit,SequenceWork& work,GCodeDebugView *debugView)
+{
+    const vector<pair<double,double>>& v = work.m_V;
+    const vector<pair<double,double>>& vTrans = work.m_VTrans;
+    if (work.m_bContact)
     {
         /*
          * The material positions recorded are the initial positions, because the new positions
          * are temporary. When material cools down, it moves to the initial and wanted positions.
          */
-        m_Deposited.push_back(Segment(v[i].first,v[i].second,v[i+1].first,v[i+1].second));
+        if (m_Params.simplify > 0)
+        {
+            /*
+             * Slicers produce tiny near-collinear segments on curves. The contact tests
+             * only need the deposited material at the simplification tolerance.
+             */
+            vector<pair<double,double>> vSimple;
+            DouglasPeucker(v,(double)m_Params.simplify / 1000.0,vSimple);
+            deposit.m_Contact->AddSequence(vSimple);
+            deposit.m_nSegments += v.size() - 1;
+            deposit.m_nSegmentsKept += vSimple.size() - 1;
+        }
+        else
+            deposit.m_Contact->AddSequence(v);
+        if (deposit.m_ContactExact)
+            deposit.m_ContactExact->AddSequence(v);
     }
+    if (!work.m_bCorrect || work.m_bWritten)
+        return;
     for (int i=0;i<vG.size();i++)
     {
         if (debugView && (vTrans[i].first != v[i].first || vTrans[i].second != v[i].second))
@@ -476,16 +775,67 @@ void StretchAlgorithmImpl::WorkOnSequence(vector<GCodeStep*>& vG,GCodeDebugView
     }
 }
 
+/** Construction du traitement spécialisé pour une combinaison de passes */
+template<unsigned Passes>
+static std::unique_ptr<StretchAlgorithm> NewStretchAlgorithm(const Params& params)
+{
+    return unique_ptr<StretchAlgorithm>(new StretchAlgorithmPasses<Passes>(params));
+}
+
 std::unique_ptr<StretchAlgorithm> StretchAlgorithmFactory(const Params& params)
 {
-    return unique_ptr<StretchAlgorithm>(new StretchAlgorithmImpl(params));
+    switch (params.passes & PASS_All)
+    {
+        case 0:
+            return NewStretchAlgorithm<0>(params);
+        case PASS_WideTurn:
+            return NewStretchAlgorithm<PASS_WideTurn>(params);
+        case PASS_WideCircle:
+            return NewStretchAlgorithm<PASS_WideCircle>(params);
+        case PASS_WideTurn | PASS_WideCircle:
+            return NewStretchAlgorithm<PASS_WideTurn | PASS_WideCircle>(params);
+        case PASS_PushWall:
+            return NewStretchAlgorithm<PASS_PushWall>(params);
+        case PASS_WideTurn | PASS_PushWall:
+            return NewStretchAlgorithm<PASS_WideTurn | PASS_PushWall>(params);
+        case PASS_WideCircle | PASS_PushWall:
+            return NewStretchAlgorithm<PASS_WideCircle | PASS_PushWall>(params);
+        case PASS_All:
+        default:
+            return NewStretchAlgorithm<PASS_All>(params);
+    }
 }
 
 void StretchAlgorithmImpl::Process(std::vector<GCodeStep>& v,GCodeDebugView *debugView)
 {
-    m_Deposited.clear();
+    if (v.size())
+    {
+        double xMin = v[0].m_X, xMax = v[0].m_X;
+        double yMin = v[0].m_Y, yMax = v[0].m_Y;
+        for (auto i = v.begin();i!=v.end();i++)
+        {
+            xMin = min(xMin,i->m_X);
+            xMax = max(xMax,i->m_X);
+            yMin = min(yMin,i->m_Y);
+            yMax = max(yMax,i->m_Y);
+        }
+        m_Deposit.Clear(xMin,yMin,xMax,yMax);
+    }
+    // Le budget n'est pas surveillé pour la couche affichée
+    bool bBudget = m_Params.layerBudgetMs > 0 && !debugView;
+    m_LayerStart = chrono::steady_clock::now();
+    m_nLayerSteps = 0;
+    m_nLayerDone = 0;
+    m_bDegraded = false;
+    /*
+     * Séquences gardées pour être traitées par îlots ou par fenêtres,
+     * ou pour compter les pas à traiter avant de surveiller le budget
+     */
+    bool bIslands = (m_Params.islandThreads > 1 || m_Params.speculativeThreads > 1 || bBudget) && !debugView;
+    vector<vector<GCodeStep*>> vSeq;
     double curE = 0;
     vector<GCodeStep*> vPos;
+    m_vArcEnds.clear();
     for (auto i = v.begin();i!=v.end();i++)
     {
         if (debugView)
@@ -496,14 +846,35 @@ void StretchAlgorithmImpl::Process(std::vector<GCodeStep>& v,GCodeDebugView *deb
         {
             curE = i->m_E;
         }
-        if (i->m_E == curE)
+        if (i->m_Step == GC_ArcCW || i->m_Step == GC_ArcCCW)
+        {
+            // Un arc termine la séquence en cours, et commence la suivante
+            if (vPos.size())
+                KeepArcEnd(vPos.back());
+            KeepArcEnd(&*i);
+            if (vPos.size() >= 2)
+            {
+                if (bIslands)
+                    vSeq.push_back(vPos);
+                else
+                    WorkOnSequence(vPos,m_Deposit,debugView);
+            }
+            vPos.clear();
+            vPos.push_back(&*i);
+        }
+        else if (i->m_E == curE)
         {
             if (debugView && vPos.size())
             {
                 cerr << "flush pos " << i-v.begin() << " step " << i->m_Step << endl;
             }
             if (vPos.size() >= 2)
-                WorkOnSequence(vPos,debugView);
+            {
+                if (bIslands)
+                    vSeq.push_back(vPos);
+                else
+                    WorkOnSequence(vPos,m_Deposit,debugView);
+            }
             vPos.clear();
             vPos.push_back(&*i);
         }
@@ -515,20 +886,458 @@ void StretchAlgorithmImpl::Process(std::vector<GCodeStep>& v,GCodeDebugView *deb
     }
     if (vPos.size() >= 2)
     {
-        WorkOnSequence(vPos,debugView);
+        if (bIslands)
+            vSeq.push_back(vPos);
+        else
+            WorkOnSequence(vPos,m_Deposit,debugView);
+    }
+    if (bBudget)
+    {
+        // Les commentaires, les déplacements isolés et les séquences ignorées selon leur type ne sont pas comptés
+        size_t nSteps = 0;
+        for (auto s = vSeq.begin();s != vSeq.end();s++)
+            if (Processed(*s))
+                nSteps += s->size();
+        m_nLayerSteps = nSteps;
+    }
+    if (bIslands && m_Params.islandThreads > 1)
+        ProcessIslands(vSeq);
+    else if (bIslands)
+        ProcessSequences(vSeq,m_Deposit);
+    RestoreArcEnds();
+    if (bBudget)
+    {
+        // Tous les pas de la projection doivent avoir été traités, et seulement eux
+        m_nBudgetSteps += m_nLayerSteps;
+        m_nBudgetDone += m_nLayerDone;
     }
+    m_nLayerSteps = 0;
+    if (m_bDegraded)
+        m_nDegradedLayers++;
+}
+
+/*
+ * Le centre d'un arc est donné relativement à son point de départ: déplacer le départ
+ * déplacerait le centre, et déplacer l'arrivée changerait le rayon. Les extrémités
+ * sont donc traitées avec leurs séquences, puis remises à leurs positions d'origine.
+ */
+void StretchAlgorithmImpl::KeepArcEnd(GCodeStep *p)
+{
+    m_vArcEnds.push_back(make_pair(p,make_pair(p->m_X,p->m_Y)));
+}
+
+void StretchAlgorithmImpl::RestoreArcEnds()
+{
+    for (auto i = m_vArcEnds.begin();i != m_vArcEnds.end();i++)
+    {
+        i->first->m_X = i->second.first;
+        i->first->m_Y = i->second.second;
+    }
+    m_vArcEnds.clear();
+}
+
+/** Distance à laquelle une séquence peut toucher le plastique déposé
+ *
+ * Les sondes de PushWall sont à une demi-largeur de mur des points, et touchent le plastique
+ * à moins d'un demi diamètre de bec. La distance est doublée pour tenir compte
+ * de l'approximation des moteurs, le plastique simplifié s'écartant en plus
+ * de la tolérance de simplification.
+ */
+static double SequenceReach(const Params& params)
+{
+    return (double)(params.nozzleDiameter + params.wallWidth + max(params.simplify,0)) / 1000.0;
+}
+
+/** Clé d'une case de la grille des empreintes des séquences d'une fenêtre */
+static long long FootprintCell(double x,double y,double cell)
+{
+    return ((long long)floor(x / cell) << 32) + (long long)floor(y / cell);
+}
+
+/** Boîtes englobantes des positions d'origine des séquences */
+static void SequenceBoxes(const vector<vector<GCodeStep*>>& vSeq,
+        vector<double>& vXMin,vector<double>& vXMax,vector<double>& vYMin,vector<double>& vYMax)
+{
+    const int n = vSeq.size();
+    vXMin.resize(n);
+    vXMax.resize(n);
+    vYMin.resize(n);
+    vYMax.resize(n);
+    for (int s=0;s<n;s++)
+    {
+        vXMin[s] = vXMax[s] = vSeq[s][0]->m_X;
+        vYMin[s] = vYMax[s] = vSeq[s][0]->m_Y;
+        for (auto i = vSeq[s].begin();i != vSeq[s].end();i++)
+        {
+            vXMin[s] = min(vXMin[s],(*i)->m_X);
+            vXMax[s] = max(vXMax[s],(*i)->m_X);
+            vYMin[s] = min(vYMin[s],(*i)->m_Y);
+            vYMax[s] = max(vYMax[s],(*i)->m_Y);
+        }
+    }
+}
+
+/** Parent d'un élément dans une partition, avec compression des chemins */
+static int IslandRoot(vector<int>& vParent,int i)
+{
+    while (vParent[i] != i)
+    {
+        vParent[i] = vParent[vParent[i]];
+        i = vParent[i];
+    }
+    return i;
+}
+
+/*
+ * Les boîtes englobantes des séquences sont agrandies de la moitié de @ref SequenceReach
+ * des deux côtés, deux séquences dont les boîtes agrandies sont disjointes
+ * ne peuvent donc pas se toucher. Les îlots sont les composantes connexes des boîtes
+ * agrandies qui se chevauchent, trouvées par un balayage selon x.
+ *
+ * Chaque îlot a son propre plastique déposé, ses séquences sont traitées dans leur ordre
+ * d'origine et modifient des pas distincts de ceux des autres îlots. Avec le moteur exact,
+ * le résultat est donc celui du traitement en série.
+ */
+void StretchAlgorithmImpl::ProcessIslands(vector<vector<GCodeStep*>>& vSeq)
+{
+    const int n = vSeq.size();
+    const double margin = SequenceReach(m_Params) / 2.0;
+    vector<double> vXMin, vXMax, vYMin, vYMax;
+    SequenceBoxes(vSeq,vXMin,vXMax,vYMin,vYMax);
+    vector<int> vOrder(n);
+    for (int s=0;s<n;s++)
+        vOrder[s] = s;
+    sort(vOrder.begin(),vOrder.end(),[&vXMin](int s1,int s2) { return vXMin[s1] < vXMin[s2]; });
+    vector<int> vParent(n);
+    for (int s=0;s<n;s++)
+        vParent[s] = s;
+    // Séquences dont la boîte agrandie peut encore chevaucher celle des suivantes selon x
+    vector<int> vActive;
+    for (auto i = vOrder.begin();i != vOrder.end();i++)
+    {
+        int s = *i;
+        size_t k = 0;
+        for (size_t j=0;j<vActive.size();j++)
+        {
+            int a = vActive[j];
+            if (vXMax[a] + margin < vXMin[s] - margin)
+                continue;
+            vActive[k++] = a;
+            if (vYMax[a] + margin >= vYMin[s] - margin && vYMin[a] - margin <= vYMax[s] + margin)
+                vParent[IslandRoot(vParent,a)] = IslandRoot(vParent,s);
+        }
+        vActive.resize(k);
+        vActive.push_back(s);
+    }
+    // Îlots dans l'ordre de leur première séquence, chacun gardant l'ordre de ses séquences
+    vector<vector<int>> vIslands;
+    vector<int> vIsland(n,-1);
+    for (int s=0;s<n;s++)
+    {
+        int r = IslandRoot(vParent,s);
+        if (vIsland[r] < 0)
+        {
+            vIsland[r] = vIslands.size();
+            vIslands.push_back(vector<int>());
+        }
+        vIslands[vIsland[r]].push_back(s);
+    }
+    if (vIslands.size() < 2)
+    {
+        ProcessSequences(vSeq,m_Deposit);
+        return;
+    }
+    m_nIslandLayers++;
+    m_nIslands += vIslands.size();
+    while (m_vIslands.size() < vIslands.size())
+        m_vIslands.push_back(unique_ptr<StretchDeposit>(new StretchDeposit(m_Params)));
+    const int nIslands = vIslands.size();
+    #pragma omp parallel for num_threads(m_Params.islandThreads) schedule(dynamic)
+    for (int c=0;c<nIslands;c++)
+    {
+        const vector<int>& vS = vIslands[c];
+        double xMin = vXMin[vS[0]], xMax = vXMax[vS[0]];
+        double yMin = vYMin[vS[0]], yMax = vYMax[vS[0]];
+        for (auto i = vS.begin();i != vS.end();i++)
+        {
+            xMin = min(xMin,vXMin[*i]);
+            xMax = max(xMax,vXMax[*i]);
+            yMin = min(yMin,vYMin[*i]);
+            yMax = max(yMax,vYMax[*i]);
+        }
+        StretchDeposit& deposit = *m_vIslands[c];
+        deposit.Clear(xMin,yMin,xMax,yMax);
+        deposit.ClearCounters();
+        for (auto i = vS.begin();i != vS.end();i++)
+            WorkOnSequence(vSeq[*i],deposit,NULL);
+    }
+    for (int c=0;c<nIslands;c++)
+        m_Deposit.AddCounters(*m_vIslands[c]);
+}
+
+/*
+ * Les séquences d'une fenêtre sont traitées en parallèle avec le plastique déposé avant
+ * la fenêtre. Les segments des séquences de la fenêtre enregistrant leur plastique marquent
+ * les cases d'une grille de la taille de @ref SequenceReach, échantillonnés tous les
+ * demi-pas de grille. Un point testé par une séquence ne peut toucher ces segments que si
+ * une des 9 cases autour de lui est marquée par une séquence précédente: la séquence est
+ * alors en conflit, et n'est traitée qu'ensuite, dans l'ordre, avec le plastique déposé
+ * par les séquences précédentes. Le plastique des autres séquences
+ * est enregistré dans l'ordre. Le résultat est donc celui du traitement en série.
+ *
+ * Le moteur récent ne garde que les dernières séquences enregistrées, son résultat
+ * dépend de l'ordre des enregistrements: ses séquences sont traitées en série.
+ */
+void StretchAlgorithmImpl::ProcessSequences(vector<vector<GCodeStep*>>& vSeq,StretchDeposit& deposit)
+{
+    const int n = vSeq.size();
+    if (m_Params.speculativeThreads < 2 || m_Params.contact == CM_Recent)
+    {
+        for (int s=0;s<n;s++)
+            WorkOnSequence(vSeq[s],deposit,NULL);
+        return;
+    }
+    const double cell = SequenceReach(m_Params);
+    unordered_set<long long> footprint;
+    const int nWindow = m_Params.speculativeWindow;
+    m_vSpeculative.resize(nWindow);
+    vector<SequenceWork> vWork(nWindow);
+    vector<char> vConflict(nWindow), vDone(nWindow);
+    for (int a=0;a<n;a+=nWindow)
+    {
+        const int nw = min(nWindow,n - a);
+        footprint.clear();
+        for (int k=0;k<nw;k++)
+        {
+            const vector<GCodeStep*>& vG = vSeq[a + k];
+            vConflict[k] = false;
+            for (auto i = vG.begin();i != vG.end() && !vConflict[k] && !footprint.empty();i++)
+                for (int dx=-1;dx<=1 && !vConflict[k];dx++)
+                    for (int dy=-1;dy<=1 && !vConflict[k];dy++)
+                        vConflict[k] = footprint.count(FootprintCell((*i)->m_X + dx*cell,(*i)->m_Y + dy*cell,cell)) != 0;
+            // Type de la séquence, comme dans ComputeSequence
+            if (m_Params.contactTypes & (1u << vG[1]->m_Feature))
+            {
+                for (int i=0;i+1<vG.size();i++)
+                {
+                    double x1 = vG[i]->m_X, y1 = vG[i]->m_Y;
+                    double x2 = vG[i+1]->m_X, y2 = vG[i+1]->m_Y;
+                    int nSteps = (int)ceil(2.0 * max(fabs(x2 - x1),fabs(y2 - y1)) / cell);
+                    for (int j=0;j<=nSteps;j++)
+                    {
+                        double f = nSteps ? (double)j / nSteps : 0;
+                        footprint.insert(FootprintCell(x1 + (x2 - x1)*f,y1 + (y2 - y1)*f,cell));
+                    }
+                }
+            }
+            StretchDeposit& slot = m_vSpeculative[k];
+            slot.m_Contact = deposit.m_Contact;
+            slot.m_ContactExact = deposit.m_ContactExact;
+            slot.ClearCounters();
+            vWork[k].m_V.clear();
+            vWork[k].m_VTrans.clear();
+        }
+        #pragma omp parallel for num_threads(m_Params.speculativeThreads) schedule(dynamic)
+        for (int k=0;k<nw;k++)
+        {
+            if (vConflict[k])
+                continue;
+            vector<GCodeStep*>& vG = vSeq[a + k];
+            TraceSpan span(vG.size() >= m_Params.traceMinSteps ? "WorkOnSequence" : NULL,vG.size(),m_nLayer);
+            vDone[k] = ComputeSequence(vG,m_vSpeculative[k],vWork[k],NULL);
+        }
+        m_nSpeculated += nw;
+        for (int k=0;k<nw;k++)
+        {
+            if (vConflict[k])
+            {
+                m_nConflicts++;
+                WorkOnSequence(vSeq[a + k],deposit,NULL);
+                continue;
+            }
+            deposit.AddCounters(m_vSpeculative[k]);
+            if (vDone[k])
+                CommitSequence(vSeq[a + k],deposit,vWork[k],NULL);
+        }
+    }
+}
+
+void StretchAlgorithmImpl::ProcessReuse(std::vector<GCodeStep>& v)
+{
+    vector<pair<double,double>> vOut;
+    bool bFound = m_Reuse->Find(v,vOut);
+    if (bFound && !m_Params.reuseVerify)
+    {
+        for (int i=0;i<v.size();i++)
+        {
+            v[i].m_X = vOut[i].first;
+            v[i].m_Y = vOut[i].second;
+        }
+        m_nReused++;
+        return;
+    }
+    vector<pair<double,double>> vIn;
+    vIn.reserve(v.size());
+    for (auto i = v.begin();i != v.end();i++)
+        vIn.push_back(make_pair(i->m_X,i->m_Y));
+    Process(v,NULL);
+    // Une couche dégradée n'est ni comparée, ni rejouée
+    if (m_bDegraded)
+        return;
+    if (bFound)
+    {
+        // Vérification: la couche rejouée doit être identique au traitement
+        m_nReused++;
+        bool bDiff = false;
+        for (int i=0;!bDiff && i<v.size();i++)
+            bDiff = v[i].m_X != vOut[i].first || v[i].m_Y != vOut[i].second;
+        if (bDiff)
+            m_nReuseDiff++;
+    }
+    m_Reuse->Record(vIn,v);
 }
 
 void StretchAlgorithmImpl::Process(int nLayer,std::vector<GCodeStep>& v)
 {
+    TraceSpan span("Process",v.size(),nLayer);
+    m_nLayer = nLayer;
     if (m_Params.dumpLayer == nLayer)
     {
         unique_ptr<GCodeDebugView> debugView(GCodeDebugViewFactory());
         Process(v,debugView.get());
     }
+    else if (m_Params.captureSlowMs > 0)
+        ProcessCapture(v);
+    else if (m_Reuse)
+        ProcessReuse(v);
     else
         Process(v,NULL);
 
 }
 
+void StretchAlgorithmImpl::ProcessCapture(std::vector<GCodeStep>& v)
+{
+    // Copie de l'entrée, le traitement modifie les positions
+    vector<GCodeStep> vIn(v);
+    auto start = chrono::steady_clock::now();
+    if (m_Reuse)
+        ProcessReuse(v);
+    else
+        Process(v,NULL);
+    double ms = chrono::duration<double,milli>(chrono::steady_clock::now() - start).count();
+    if (ms <= m_Params.captureSlowMs)
+        return;
+    string file = LayerSnapshotFile(m_Params.captureDir,m_nLayer);
+    ofstream os(file.c_str(),ios::binary);
+    LayerSnapshotWrite(os,m_nLayer,m_Params,vIn);
+    os.close();
+    if (!os)
+        cerr << "Unable to write layer snapshot " << file << endl;
+    else
+        m_nCaptured++;
+}
+
+/** Taille du plateau en mm, la boîte englobante d'une couche reçue en flux n'est pas connue */
+static const double StreamBedSize = 200.0;
 
+/*
+ * Même découpage en séquences que Process, mais chaque séquence est traitée dès qu'elle
+ * est terminée. Seuls les pas à partir du début de la séquence en cours restent en attente.
+ * Les pointeurs vers les pas de la séquence en cours restent valides, les pas
+ * n'étant ajoutés qu'à la fin de v et retirés qu'au début.
+ */
+size_t StretchAlgorithmImpl::ProcessStream(int nLayer,std::deque<GCodeStep>& v,bool bEnd)
+{
+    if (bEnd)
+    {
+        if (m_vStreamPos.size() >= 2)
+            WorkOnSequence(m_vStreamPos,m_Deposit,NULL);
+        RestoreArcEnds();
+        m_vStreamPos.clear();
+        m_nStreamPending = 0;
+        m_nStreamLayer = 0;
+        return v.size();
+    }
+    GCodeStep& step = v.back();
+    if (nLayer != m_nStreamLayer)
+    {
+        m_Deposit.Clear(0,0,StreamBedSize,StreamBedSize);
+        m_nStreamLayer = nLayer;
+        m_nLayer = nLayer;
+        m_StreamE = step.m_E;
+        m_vStreamPos.clear();
+        m_vArcEnds.clear();
+        m_nStreamPending = 0;
+    }
+    bool bArc = step.m_Step == GC_ArcCW || step.m_Step == GC_ArcCCW;
+    if (bArc && m_vStreamPos.size())
+        KeepArcEnd(m_vStreamPos.back());
+    if (step.m_E == m_StreamE || bArc)
+    {
+        if (m_vStreamPos.size() >= 2)
+            WorkOnSequence(m_vStreamPos,m_Deposit,NULL);
+        RestoreArcEnds();
+        // L'arrivée de l'arc est gardée jusqu'au traitement de la séquence qu'il commence
+        if (bArc)
+            KeepArcEnd(&step);
+        m_vStreamPos.clear();
+        m_vStreamPos.push_back(&step);
+        m_nStreamPending = 1;
+    }
+    else
+    {
+        m_nStreamPending++;
+        if (step.m_Step == GC_MoveFast || step.m_Step == GC_MoveLin)
+        {
+            m_vStreamPos.push_back(&step);
+            if (m_Params.streamWindow > 0 && m_vStreamPos.size() >= (size_t)m_Params.streamWindow)
+            {
+                // Séquence trop longue, coupée en deux séquences partageant le dernier point
+                WorkOnSequence(m_vStreamPos,m_Deposit,NULL);
+                RestoreArcEnds();
+                m_vStreamPos.clear();
+                m_vStreamPos.push_back(&step);
+                m_nStreamPending = 1;
+            }
+        }
+    }
+    m_StreamE = step.m_E;
+    return v.size() - m_nStreamPending;
+}
+
+void StretchAlgorithmImpl::Report(std::ostream& os)
+{
+    if (m_Reuse)
+    {
+        os << "Reuse: " << m_nReused << " layers replayed";
+        if (m_Params.reuseVerify)
+            os << ", " << m_nReuseDiff << " differ from the processing";
+        os << endl;
+    }
+    if (m_Params.captureSlowMs > 0)
+        os << "Capture: " << m_nCaptured << " layers slower than " << m_Params.captureSlowMs
+            << " ms written to " << m_Params.captureDir << endl;
+    if (m_Params.speculativeThreads > 1)
+        os << "Speculation: " << m_nConflicts << " of " << m_nSpeculated << " sequences processed again after a conflict" << endl;
+    if (m_Params.islandThreads > 1)
+        os << "Islands: " << m_nIslandLayers << " layers split in " << m_nIslands << " islands" << endl;
+    const StretchDeposit& d = m_Deposit;
+    if (m_Params.layerBudgetMs > 0)
+        os << "Layer budget: " << m_nDegradedLayers << " layers over " << m_Params.layerBudgetMs << " ms, "
+            << d.m_nDegraded << " sequences without PushWall, " << m_nBudgetDone << " of "
+            << m_nBudgetSteps << " projected steps processed" << endl;
+    if (d.m_nUncorrected || d.m_nNoContact)
+        os << "Feature types: " << d.m_nUncorrected << " sequences not corrected, "
+            << d.m_nNoContact << " not recorded as contact" << endl;
+    if (m_Params.simplify > 0)
+        os << "Simplification: " << d.m_nSegmentsKept << " of " << d.m_nSegments << " deposited segments kept" << endl;
+    if (d.m_ContactExact)
+    {
+        os << "Contact check: " << d.m_nProbesDiff << " of " << d.m_nProbes << " probes";
+        os << " and " << d.m_nVerticesDiff << " of " << d.m_nVertices << " vertices";
+        os << " differ from the exact engine";
+        if (d.m_nVertices)
+            os << " (" << 100.0 * d.m_nVerticesDiff / d.m_nVertices << "% of vertices)";
+        os << endl;
+    }
+}
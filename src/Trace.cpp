@@ -0,0 +1,112 @@
+#include "Trace.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <iomanip>
+
+using namespace std;
+
+/** Span recorded by a thread */
+struct TraceSpanEvent
+{
+    const char *m_Name;
+    double m_Start;
+    double m_Duration;
+    int m_nSteps;
+    int m_nLayer;
+};
+
+/** Spans recorded by a thread, written only by this thread */
+struct TraceBuffer
+{
+    int m_Tid /** Thread number in the trace */;
+    vector<TraceSpanEvent> m_vEvents;
+
+    TraceBuffer(int tid) : m_Tid(tid) {}
+};
+
+static atomic<bool> g_bTraceEnabled(false);
+static chrono::steady_clock::time_point g_TraceStart;
+/** Protects only the registration of the buffers */
+static mutex g_TraceMutex;
+/** Buffers of all the threads, kept after the end of their thread */
+static vector<unique_ptr<TraceBuffer>> g_vTraceBuffers;
+
+/** Buffer of the current thread, registered on the first call */
+static TraceBuffer& LocalBuffer()
+{
+    static thread_local TraceBuffer *buffer = nullptr;
+    if (!buffer)
+    {
+        lock_guard<mutex> lock(g_TraceMutex);
+        g_vTraceBuffers.emplace_back(new TraceBuffer(g_vTraceBuffers.size() + 1));
+        buffer = g_vTraceBuffers.back().get();
+    }
+    return *buffer;
+}
+
+void TraceStart()
+{
+    {
+        lock_guard<mutex> lock(g_TraceMutex);
+        for (auto i = g_vTraceBuffers.begin();i != g_vTraceBuffers.end();i++)
+            (*i)->m_vEvents.clear();
+    }
+    g_TraceStart = chrono::steady_clock::now();
+    g_bTraceEnabled = true;
+}
+
+void TraceStop()
+{
+    g_bTraceEnabled = false;
+}
+
+bool TraceEnabled()
+{
+    return g_bTraceEnabled.load(memory_order_relaxed);
+}
+
+double TraceNow()
+{
+    return chrono::duration<double,micro>(chrono::steady_clock::now() - g_TraceStart).count();
+}
+
+void TraceEvent(const char *name,double start,int nSteps,int nLayer)
+{
+    TraceSpanEvent e;
+    e.m_Name = name;
+    e.m_Start = start;
+    e.m_Duration = TraceNow() - start;
+    e.m_nSteps = nSteps;
+    e.m_nLayer = nLayer;
+    LocalBuffer().m_vEvents.push_back(e);
+}
+
+void TraceWrite(ostream& os)
+{
+    lock_guard<mutex> lock(g_TraceMutex);
+    ios::fmtflags flags = os.flags();
+    streamsize precision = os.precision(3);
+    os << fixed;
+    os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool bFirst = true;
+    for (auto b = g_vTraceBuffers.begin();b != g_vTraceBuffers.end();b++)
+    {
+        for (auto e = (*b)->m_vEvents.begin();e != (*b)->m_vEvents.end();e++)
+        {
+            os << (bFirst ? "\n" : ",\n");
+            bFirst = false;
+            os << "{\"name\":\"" << e->m_Name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (*b)->m_Tid
+                << ",\"ts\":" << e->m_Start << ",\"dur\":" << e->m_Duration
+                << ",\"args\":{\"steps\":" << e->m_nSteps;
+            if (e->m_nLayer)
+                os << ",\"layer\":" << e->m_nLayer;
+            os << "}}";
+        }
+    }
+    os << "\n]}" << endl;
+    os.flags(flags);
+    os.precision(precision);
+}
@@ -0,0 +1,71 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+/** @file */
+
+#include <ostream>
+
+/** @brief Timeline of the processing, in the Chrome trace-event format
+ *
+ * The spans are recorded in a buffer owned by each thread, registered once
+ * on the first span of the thread, so recording never locks.
+ * The file can be loaded in chrome://tracing or in the Perfetto viewer.
+ *
+ * When tracing is not started, recording a span only tests a flag.
+ */
+
+/** Starts recording spans, and clears the spans recorded before */
+void TraceStart();
+
+/** Stops recording spans, the recorded spans are kept for @ref TraceWrite */
+void TraceStop();
+
+/** True if spans are recorded */
+bool TraceEnabled();
+
+/** Current time, in microseconds since @ref TraceStart */
+double TraceNow();
+
+/** Records a span of the current thread
+ *
+ * @param name Name of the span, must be a string literal
+ * @param start Start time, from @ref TraceNow
+ * @param nSteps Number of g-code steps handled by the span
+ * @param nLayer Layer number, or 0 if the span does not belong to a layer
+ */
+void TraceEvent(const char *name,double start,int nSteps,int nLayer = 0);
+
+/** Writes the recorded spans of all the threads in the trace-event JSON format
+ *
+ * Must not be called while other threads record spans
+ */
+void TraceWrite(std::ostream& os);
+
+/** @brief Span recorded from its construction to its destruction */
+class TraceSpan
+{
+    public:
+        /** Starts a span, with the parameters of @ref TraceEvent
+         *
+         * If the name is NULL, the span is not recorded
+         */
+        TraceSpan(const char *name,int nSteps,int nLayer = 0) :
+            m_Name(name),
+            m_nSteps(nSteps),
+            m_nLayer(nLayer),
+            m_Start(name && TraceEnabled() ? TraceNow() : 0) {}
+        ~TraceSpan()
+        {
+            if (m_Name && TraceEnabled())
+                TraceEvent(m_Name,m_Start,m_nSteps,m_nLayer);
+        }
+    private:
+        TraceSpan(const TraceSpan&);
+        TraceSpan& operator=(const TraceSpan&);
+        const char *m_Name;
+        int m_nSteps;
+        int m_nLayer;
+        double m_Start;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <fstream>
+#include "Patch.h"
+
+using namespace std;
+
+namespace po = boost::program_options;
+
+/*
+ * Writes the g-code processed by post_stretch --patch, from the original g-code and the patch
+ */
+int main(int argc,char **argv)
+{
+    string GCodeFile;
+    string patchFile;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "produce help message")
+        ("input-file",po::value<string>(&GCodeFile),"original g-code file name")
+        ("patch",po::value<string>(&patchFile),"patch file name")
+        ;
+    po::positional_options_description p;
+    p.add("input-file",1);
+    p.add("patch",1);
+    try
+    {
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+        po::notify(vm);
+        if (vm.count("help") || GCodeFile.empty() || patchFile.empty())
+        {
+            cout << "Usage: post_stretch_apply infile patch >outfile" << endl;
+            cout << desc << "\n";
+            return vm.count("help") ? 0 : -1;
+        }
+        ifstream is(GCodeFile.c_str(),ios::binary);
+        if (!is.is_open())
+        {
+            cerr << "Unable to read input file " << GCodeFile << endl;
+            return -1;
+        }
+        ifstream isp(patchFile.c_str(),ios::binary);
+        if (!isp.is_open())
+        {
+            cerr << "Unable to read patch file " << patchFile << endl;
+            return -1;
+        }
+        ios::sync_with_stdio(false);
+        PatchApply(is,isp,cout);
+        cout.flush();
+    }
+    catch (std::exception& err)
+    {
+        cerr << err.what() << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -4,13 +4,49 @@
 #include "GCodeParser.h"
 #include "StretchAlgorithm.h"
 #include "params.h"
+#include "Trace.h"
+#include "FileCopy.h"
+#include "AsyncOutput.h"
+#include "PerfCounters.h"
+#include "StepCache.h"
 #include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 using namespace std;
 
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
+/** Parses a comma separated list of feature types
+ *
+ * @param list List of names of @ref GCodeFeature, or all
+ * @param types Combination of 1 << @ref EFeature
+ * @return false if a name is unknown
+ */
+static bool FeatureTypes(const string& list,unsigned& types)
+{
+    types = 0;
+    istringstream is(list);
+    string name;
+    while (getline(is,name,','))
+    {
+        EFeature feature;
+        if (name == "all")
+            types = ~0u;
+        else if (GCodeFeature(name,feature))
+            types |= 1u << feature;
+        else
+        {
+            cerr << "Unknown feature type " << name << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 void Usage(po::options_description& visible)
 {
     cout << "Usage: post_stretch infile [options]" << endl;
@@ -21,6 +57,16 @@ int main(int argc,char **argv)
 {
     string GCodeFile;
     string confFile;
+    string contact;
+    string passes;
+    string correctTypes;
+    string contactTypes;
+    string traceFile;
+    string perfFile;
+    bool bDumpOnly = false;
+    bool bAsyncOutput = false;
+    bool bStepCache = false;
+    string layers;
     Params params;
     /*
      * Options allowed only on command line
@@ -41,6 +87,36 @@ int main(int argc,char **argv)
         ("width",po::value<int>(&params.wallWidth)->default_value(700),"Wall width in microns")
         ("nozzle",po::value<int>(&params.nozzleDiameter)->default_value(800),"Nozzle diameter in microns")
         ("dumpLayer",po::value<int>(&params.dumpLayer)->default_value(0),"Debug one layer")
+        ("layers",po::value<string>(&layers),"Process only the layers A to B, given as A-B, and copy the others")
+        ("stream",po::bool_switch(&params.stream),"Write each sequence as soon as it is processed")
+        ("streamWindow",po::value<int>(&params.streamWindow)->default_value(2000),"Maximal number of points of a sequence in streaming mode, 0 for no limit")
+        ("reuse",po::bool_switch(&params.reuse),"Replay the processing of previous layers with the same positions")
+        ("reuseVerify",po::bool_switch(&params.reuseVerify),"Process the replayed layers and count the differences")
+        ("patch",po::value<string>(&params.patch),"Write a patch of the input file instead of the g-code")
+        ("asyncOutput",po::bool_switch(&bAsyncOutput),"Write the output from a thread, through io_uring when available")
+        ("stepCache",po::bool_switch(&bStepCache),"Read the parsed steps from a cache file next to the input file, written by the first run")
+        ("dumpOnly",po::bool_switch(&bDumpOnly),"Process only the debugged layer, using the layer index file")
+        ("contact",po::value<string>(&contact)->default_value("exact"),"Contact detection engine: exact, raster, recent or tiled")
+        ("raster",po::value<int>(&params.rasterResolution)->default_value(50),"Raster cell size in microns")
+        ("recentSequences",po::value<int>(&params.recentSequences)->default_value(8),"Number of sequences kept by the recent engine, 0 for no limit")
+        ("recentLength",po::value<double>(&params.recentLength)->default_value(0),"Length of path in mm kept by the recent engine, 0 for no limit")
+        ("contactCheck",po::bool_switch(&params.contactCheck),"Count contact decisions differing from the exact engine")
+        ("arcTolerance",po::value<int>(&params.arcTolerance)->default_value(0),"Arc fitting tolerance in microns, 0 to disable")
+        ("simplify",po::value<int>(&params.simplify)->default_value(0),"Simplification tolerance of deposited segments in microns, 0 to disable")
+        ("passes",po::value<string>(&passes)->default_value("wideturn,widecircle,pushwall"),"Comma separated list of passes, or none")
+        ("fusedPasses",po::bool_switch(&params.fusedPasses),"Apply the passes in a single traversal of each sequence, with the same results")
+        ("correctTypes",po::value<string>(&correctTypes)->default_value("all"),"Comma separated list of the feature types corrected, from the ;TYPE: comments")
+        ("contactTypes",po::value<string>(&contactTypes)->default_value("all"),"Comma separated list of the feature types recorded as deposited material")
+        ("layerBudgetMs",po::value<double>(&params.layerBudgetMs)->default_value(0),"Processing time of a layer in ms above which the rest of the layer is processed without PushWall, 0 to disable")
+        ("captureSlowMs",po::value<int>(&params.captureSlowMs)->default_value(0),"Save the input of the layers processed in more than this time in ms, 0 to disable")
+        ("captureDir",po::value<string>(&params.captureDir)->default_value("."),"Directory of the saved layers, replayed with replay_layer")
+        ("trace",po::value<string>(&traceFile),"Write a Chrome trace-event timeline of the processing")
+        ("perfCounters",po::value<string>(&perfFile),"Write the hardware performance counters of each stage of each layer")
+        ("parseThreads",po::value<int>(&params.parseThreads)->default_value(1),"Number of threads parsing the input file")
+        ("speculativeThreads",po::value<int>(&params.speculativeThreads)->default_value(1),"Number of threads processing windows of sequences in advance")
+        ("speculativeWindow",po::value<int>(&params.speculativeWindow)->default_value(32),"Number of sequences of a window processed in advance")
+        ("islandThreads",po::value<int>(&params.islandThreads)->default_value(1),"Number of threads processing the independent islands of a layer")
+        ("traceMinSteps",po::value<unsigned>(&params.traceMinSteps)->default_value(100),"Minimal number of steps of a traced sequence")
         ;
 
     /*
@@ -102,18 +178,249 @@ int main(int argc,char **argv)
             Usage(visible);
             return -1;
         }
-        unique_ptr<StretchAlgorithm> algo(StretchAlgorithmFactory(params));
-        if (GCodeFile == "-")
-            GCodeParser(algo.get(),cin);
+        if (contact == "exact")
+            params.contact = CM_Exact;
+        else if (contact == "raster")
+            params.contact = CM_Raster;
+        else if (contact == "recent")
+            params.contact = CM_Recent;
+        else if (contact == "tiled")
+            params.contact = CM_Tiled;
         else
         {
-            ifstream is(GCodeFile.c_str());
-            if (!is.is_open())
+            cerr << "Unknown contact detection engine " << contact << endl;
+            return -1;
+        }
+        params.passes = 0;
+        istringstream isPasses(passes);
+        string pass;
+        while (getline(isPasses,pass,','))
+        {
+            if (pass == "wideturn")
+                params.passes |= PASS_WideTurn;
+            else if (pass == "widecircle")
+                params.passes |= PASS_WideCircle;
+            else if (pass == "pushwall")
+                params.passes |= PASS_PushWall;
+            else if (pass != "none")
+            {
+                cerr << "Unknown pass " << pass << endl;
+                return -1;
+            }
+        }
+        if (!FeatureTypes(correctTypes,params.correctTypes) || !FeatureTypes(contactTypes,params.contactTypes))
+            return -1;
+        if (params.stream && params.dumpLayer)
+        {
+            cerr << "The debug view is not available in streaming mode" << endl;
+            return -1;
+        }
+        if (params.streamWindow == 1 || params.streamWindow < 0)
+        {
+            cerr << "The streaming window must be 0 or at least 2 points" << endl;
+            return -1;
+        }
+        if (!params.patch.empty() && (params.stream || params.arcTolerance > 0 || !layers.empty() || bDumpOnly))
+        {
+            cerr << "A patch can't be written with --stream, --arcTolerance, --layers or --dumpOnly" << endl;
+            return -1;
+        }
+        if (bAsyncOutput && (!layers.empty() || bDumpOnly))
+        {
+            cerr << "The asynchronous output can't be used with --layers or --dumpOnly" << endl;
+            return -1;
+        }
+        if (bStepCache && (GCodeFile == "-" || !layers.empty() || bDumpOnly))
+        {
+            cerr << "The step cache needs an input file, and can't be used with --layers or --dumpOnly" << endl;
+            return -1;
+        }
+        if (params.captureSlowMs < 0 || (params.captureSlowMs > 0 && params.stream))
+        {
+            cerr << "The capture time must be positive, and the layers can't be saved in streaming mode" << endl;
+            return -1;
+        }
+        if (params.layerBudgetMs < 0 || (params.layerBudgetMs > 0 && params.stream))
+        {
+            cerr << "The layer budget must be positive, and can't be used in streaming mode" << endl;
+            return -1;
+        }
+        if (params.parseThreads < 1)
+        {
+            cerr << "The number of parsing threads must be at least 1" << endl;
+            return -1;
+        }
+        if (params.speculativeThreads < 1 || params.speculativeWindow < 1)
+        {
+            cerr << "The number of speculative threads and the window must be at least 1" << endl;
+            return -1;
+        }
+        if (params.islandThreads < 1)
+        {
+            cerr << "The number of island threads must be at least 1" << endl;
+            return -1;
+        }
+        if (!perfFile.empty() && (params.islandThreads > 1 || params.speculativeThreads > 1))
+        {
+            cerr << "The performance counters only count the main thread, they can't be used with --islandThreads or --speculativeThreads" << endl;
+            return -1;
+        }
+        if (params.recentSequences < 0 || params.recentLength < 0)
+        {
+            cerr << "The limits of the recent contact engine can't be negative" << endl;
+            return -1;
+        }
+        if (params.rasterResolution <= 0)
+        {
+            cerr << "Raster cell size must be positive" << endl;
+            return -1;
+        }
+        if (!traceFile.empty())
+            TraceStart();
+        if (!perfFile.empty())
+            PerfCountersStart();
+        int first = 0, last = 0;
+        if (!layers.empty())
+        {
+            char c = 0;
+            istringstream isLayers(layers);
+            isLayers >> first;
+            if (isLayers >> c)
+            {
+                if (c != '-' || !(isLayers >> last) || !isLayers.eof())
+                    first = 0;
+            }
+            else
+                last = first;
+            if (first < 1 || last < first)
+            {
+                cerr << "Invalid layer range " << layers << endl;
+                return -1;
+            }
+        }
+        if (bDumpOnly)
+        {
+            if (params.dumpLayer <= 0)
+            {
+                cerr << "--dumpOnly needs --dumpLayer" << endl;
+                return -1;
+            }
+            first = last = params.dumpLayer;
+        }
+        unique_ptr<StretchAlgorithm> algo(StretchAlgorithmFactory(params));
+        if (first)
+        {
+            if (GCodeFile == "-")
+            {
+                cerr << "A layer range needs an input file" << endl;
+                return -1;
+            }
+            ifstream is(GCodeFile.c_str(),ios::binary);
+            int fdIn = open(GCodeFile.c_str(),O_RDONLY);
+            if (!is.is_open() || fdIn < 0)
             {
                 cerr << "Unable to read input file " << GCodeFile << endl;
                 return -1;
             }
-            GCodeParser(algo.get(),is);
+            vector<GCodeLayerIndex> vIndex;
+            if (!LayerIndexLoad(GCodeFile,vIndex))
+            {
+                GCodeIndex(is,vIndex);
+                if (!LayerIndexSave(GCodeFile,vIndex))
+                    cerr << "Unable to write index file " << LayerIndexFile(GCodeFile) << endl;
+            }
+            if (last > vIndex.size())
+            {
+                cerr << "The file has only " << vIndex.size() << " layers" << endl;
+                return -1;
+            }
+            /*
+             * Layers outside of the range are copied unchanged, the written data
+             * must be flushed before and after each copy
+             */
+            struct stat st;
+            fstat(fdIn,&st);
+            cout.flush();
+            fflush(stdout);
+            if (!bDumpOnly)
+                CopyFileRange(fdIn,0,vIndex[first-1].m_Offset,STDOUT_FILENO);
+            GCodeParseLayers(algo.get(),is,vIndex,first,last,params);
+            cout.flush();
+            fflush(stdout);
+            if (!bDumpOnly && last < vIndex.size())
+                CopyFileRange(fdIn,vIndex[last].m_Offset,st.st_size - vIndex[last].m_Offset,STDOUT_FILENO);
+            close(fdIn);
+        }
+        else
+        {
+            /*
+             * The asynchronous output replaces the buffer of cout,
+             * the data written before must be flushed
+             */
+            unique_ptr<AsyncOutput> output;
+            streambuf *coutBuf = cout.rdbuf();
+            if (bAsyncOutput)
+            {
+                cout.flush();
+                output.reset(new AsyncOutput(STDOUT_FILENO));
+                cout.rdbuf(output.get());
+            }
+            try
+            {
+                if (GCodeFile == "-")
+                    GCodeParser(algo.get(),cin,params);
+                else
+                {
+                    ifstream is(GCodeFile.c_str());
+                    if (!is.is_open())
+                    {
+                        cout.rdbuf(coutBuf);
+                        cerr << "Unable to read input file " << GCodeFile << endl;
+                        return -1;
+                    }
+                    StepCache cache;
+                    if (bStepCache && !cache.Open(GCodeFile))
+                    {
+                        GCodeParser(algo.get(),is,params,&cache);
+                        if (!cache.Save())
+                            cerr << "Unable to write step cache file " << StepCacheFile(GCodeFile) << endl;
+                    }
+                    else
+                        GCodeParser(algo.get(),is,params,bStepCache ? &cache : NULL);
+                }
+            }
+            catch (...)
+            {
+                cout.rdbuf(coutBuf);
+                throw;
+            }
+            cout.rdbuf(coutBuf);
+            if (output)
+                output->Close();
+        }
+        algo->Report(cerr);
+        if (!perfFile.empty())
+        {
+            PerfCountersStop();
+            PerfCountersReport(cerr);
+            ofstream osp(perfFile.c_str());
+            PerfCountersWrite(osp);
+            if (!osp)
+            {
+                cerr << "Unable to write performance counters file " << perfFile << endl;
+                return -1;
+            }
+        }
+        if (!traceFile.empty())
+        {
+            TraceStop();
+            ofstream ost(traceFile.c_str());
+            TraceWrite(ost);
+            if (!ost)
+            {
+                cerr << "Unable to write trace file " << traceFile << endl;
+                return -1;
+            }
         }
     }
     catch (std::exception& err)
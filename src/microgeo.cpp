@@ -111,4 +111,54 @@ void ExterieurVirage(
     yp = y2 - (dist/d1)*(ppy-y2);
 }
 
-
+void DouglasPeucker(
+        const std::vector<std::pair<double,double>>& v,
+        double tolerance,
+        std::vector<std::pair<double,double>>& vOut)
+{
+    vOut.clear();
+    int sz = v.size();
+    if (sz <= 2)
+    {
+        vOut = v;
+        return;
+    }
+    double t2 = tolerance * tolerance;
+    std::vector<bool> vKeep(sz,false);
+    vKeep[0] = vKeep[sz-1] = true;
+    // Pile des intervalles restant à traiter, sans récursivité pour les longues séquences
+    std::vector<std::pair<int,int>> pile;
+    pile.push_back(std::pair<int,int>(0,sz-1));
+    while (pile.size())
+    {
+        int i1 = pile.back().first;
+        int i2 = pile.back().second;
+        pile.pop_back();
+        double dMax = -1;
+        int iMax = -1;
+        for (int i=i1+1;i<i2;i++)
+        {
+            double d;
+            if (v[i1] == v[i2]) // Segment dégénéré, par exemple une boucle fermée
+                d = ProduitScalaire(v[i].first-v[i1].first,v[i].second-v[i1].second,
+                        v[i].first-v[i1].first,v[i].second-v[i1].second);
+            else
+                d = CarreDistanceSegmentPoint(v[i].first,v[i].second,
+                        v[i1].first,v[i1].second,v[i2].first,v[i2].second);
+            if (d > dMax)
+            {
+                dMax = d;
+                iMax = i;
+            }
+        }
+        if (iMax >= 0 && dMax > t2)
+        {
+            vKeep[iMax] = true;
+            pile.push_back(std::pair<int,int>(i1,iMax));
+            pile.push_back(std::pair<int,int>(iMax,i2));
+        }
+    }
+    for (int i=0;i<sz;i++)
+        if (vKeep[i])
+            vOut.push_back(v[i]);
+}
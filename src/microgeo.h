@@ -3,6 +3,9 @@
 
 /** @file Micro librairie de géométrie */
 
+#include <vector>
+#include <utility>
+
 /** Distance entre un point et un segment
  *
  * @param px coordonnée X du point
@@ -87,5 +90,19 @@ void ExterieurVirage(
         double& xp,
         double& yp);
 
+/** Simplification d'une polyligne par l'algorithme de Douglas-Peucker
+ *
+ * Tout point de la polyligne d'origine est à une distance au plus tolerance
+ * de la polyligne simplifiée, et réciproquement. La distance d'un point quelconque
+ * aux deux polylignes diffère donc au plus de tolerance.
+ *
+ * @param v Points de la polyligne d'origine
+ * @param tolerance Distance maximale entre les deux polylignes
+ * @param vOut Polyligne simplifiée, qui contient toujours le premier et le dernier point
+ */
+void DouglasPeucker(
+        const std::vector<std::pair<double,double>>& v,
+        double tolerance,
+        std::vector<std::pair<double,double>>& vOut);
 
 #endif
@@ -3,6 +3,26 @@
 
 /** @file */
 
+#include <string>
+
+/** Contact detection engines */
+enum EContactMode
+{
+    CM_Exact /**< Exact distance to every deposited segment */,
+    CM_Raster /**< Lookup in an occupancy bitmap of the deposited material */,
+    CM_Recent /**< Exact distance to the recently deposited segments only */,
+    CM_Tiled /**< Distance to the deposited segments of the neighbouring tiles, stored in microns */
+};
+
+/** Passes applied to each sequence, may be combined */
+enum EPass
+{
+    PASS_WideTurn = 1 /**< Moves points outside the turns of open sequences */,
+    PASS_WideCircle = 2 /**< Moves points outside the turns of closed sequences */,
+    PASS_PushWall = 4 /**< Moves points towards the walls deposited before */,
+    PASS_All = 7 /**< All the passes */
+};
+
 /** @brief Global parameters */
 struct Params
 {
@@ -10,6 +30,59 @@ struct Params
     int wallWidth /** Wall width in microns */;
     int dumpLayer /** Layer to debug, or 0 */;
     int nozzleDiameter /** Nozzle diameter in microns */;
+    EContactMode contact /** Contact detection engine */;
+    int rasterResolution /** Cell size of the occupancy bitmap in microns */;
+    bool contactCheck /** Counts the contact decisions which differ from the exact engine */;
+    int arcTolerance /** Arc fitting tolerance in microns, or 0 to keep linear moves */;
+    int simplify /** Simplification tolerance of the deposited segments in microns, or 0 to keep all of them */;
+    unsigned passes /** Combination of @ref EPass */;
+    bool fusedPasses /** Applies the passes and writes the positions in a single traversal of each sequence */;
+    unsigned traceMinSteps /** Minimal number of steps of a sequence to record its span in the trace */;
+    int parseThreads /** Number of parsing threads, 1 for the serial parser */;
+    int speculativeThreads /** Number of threads processing the sequences of a window in advance, 1 to process them in order */;
+    int speculativeWindow /** Number of sequences of a window processed in advance */;
+    int islandThreads /** Number of threads processing the independent islands of a layer, 1 to process the sequences in order */;
+    bool stream /** Writes each sequence as soon as it is processed, instead of each layer */;
+    int streamWindow /** Maximal number of points of a sequence in streaming mode, or 0 for no limit */;
+    std::string patch /** If not empty, file of the patch written instead of the g-code */;
+    bool reuse /** Replays the processing of a previous layer with the same positions */;
+    bool reuseVerify /** Processes the replayed layers and counts the differences */;
+    int recentSequences /** Number of sequences kept by the recent contact engine, or 0 for no limit */;
+    double recentLength /** Length of path in mm kept by the recent contact engine, or 0 for no limit */;
+    unsigned correctTypes /** Feature types of the corrected sequences, combination of 1 << @ref EFeature */;
+    unsigned contactTypes /** Feature types of the sequences recorded as deposited material, combination of 1 << @ref EFeature */;
+    double layerBudgetMs /** Processing time of a layer in ms above which the rest of the layer is processed without PushWall, or 0 */;
+    int captureSlowMs /** Processing time in ms above which the input of a layer is saved, or 0 */;
+    std::string captureDir /** Directory of the saved layers */;
+
+    Params() :
+        stretch(170),
+        wallWidth(700),
+        dumpLayer(0),
+        nozzleDiameter(800),
+        contact(CM_Exact),
+        rasterResolution(50),
+        contactCheck(false),
+        arcTolerance(0),
+        simplify(0),
+        passes(PASS_All),
+        fusedPasses(false),
+        traceMinSteps(100),
+        parseThreads(1),
+        speculativeThreads(1),
+        speculativeWindow(32),
+        islandThreads(1),
+        stream(false),
+        streamWindow(2000),
+        reuse(false),
+        reuseVerify(false),
+        recentSequences(8),
+        recentLength(0),
+        correctTypes(~0u),
+        contactTypes(~0u),
+        layerBudgetMs(0),
+        captureSlowMs(0),
+        captureDir(".") {}
 };
 
 #endif
@@ -0,0 +1,107 @@
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <stdint.h>
+#include "StretchAlgorithm.h"
+#include "LayerSnapshot.h"
+#include "params.h"
+
+using namespace std;
+
+namespace po = boost::program_options;
+
+/** FNV-1a hash of the positions of the processed steps, at the micron */
+static uint64_t Checksum(const vector<GCodeStep>& v)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (auto i = v.begin();i != v.end();i++)
+    {
+        long long p[2] = { (long long)(i->m_X * 1000.0 + 0.5), (long long)(i->m_Y * 1000.0 + 0.5) };
+        const unsigned char *c = (const unsigned char *)p;
+        for (int k=0;k<sizeof(p);k++)
+        {
+            h ^= c[k];
+            h *= 1099511628211ULL;
+        }
+    }
+    return h;
+}
+
+/*
+ * Processes a layer saved by post_stretch --captureSlowMs several times,
+ * under a profiler or to measure an optimization
+ */
+int main(int argc,char **argv)
+{
+    string snapshotFile;
+    int nRepeat;
+    // How the layer is processed is not saved, it is chosen for the replay
+    Params strategy;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "produce help message")
+        ("snapshot",po::value<string>(&snapshotFile),"layer snapshot file name")
+        ("repeat",po::value<int>(&nRepeat)->default_value(10),"number of runs of the processing")
+        ("fusedPasses",po::bool_switch(&strategy.fusedPasses),"Apply the passes in a single traversal of each sequence")
+        ("islandThreads",po::value<int>(&strategy.islandThreads)->default_value(1),"Number of threads processing the independent islands of a layer")
+        ("speculativeThreads",po::value<int>(&strategy.speculativeThreads)->default_value(1),"Number of threads processing the sequences of a window in advance")
+        ("speculativeWindow",po::value<int>(&strategy.speculativeWindow)->default_value(32),"Number of sequences of a window processed in advance")
+        ;
+    po::positional_options_description p;
+    p.add("snapshot",1);
+    try
+    {
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), vm);
+        po::notify(vm);
+        if (vm.count("help") || snapshotFile.empty() || nRepeat < 1 || strategy.islandThreads < 1
+                || strategy.speculativeThreads < 1 || strategy.speculativeWindow < 1)
+        {
+            cout << "Usage: replay_layer snapshot [options]" << endl;
+            cout << desc << "\n";
+            return vm.count("help") ? 0 : -1;
+        }
+        ifstream is(snapshotFile.c_str(),ios::binary);
+        int nLayer;
+        Params params;
+        vector<GCodeStep> vIn;
+        if (!is.is_open() || !LayerSnapshotRead(is,nLayer,params,vIn))
+        {
+            cerr << "Unable to read layer snapshot " << snapshotFile << endl;
+            return -1;
+        }
+        // Each run must process the whole layer the same way: no debug view, no replay
+        // of the previous run, and no time budget
+        params.dumpLayer = 0;
+        params.reuse = false;
+        params.layerBudgetMs = 0;
+        params.fusedPasses = strategy.fusedPasses;
+        params.islandThreads = strategy.islandThreads;
+        params.speculativeThreads = strategy.speculativeThreads;
+        params.speculativeWindow = strategy.speculativeWindow;
+        unique_ptr<StretchAlgorithm> algo(StretchAlgorithmFactory(params));
+        vector<double> vTimes;
+        vector<GCodeStep> v;
+        for (int n=0;n<nRepeat;n++)
+        {
+            v = vIn;
+            auto start = chrono::steady_clock::now();
+            algo->Process(nLayer,v);
+            vTimes.push_back(chrono::duration<double,milli>(chrono::steady_clock::now() - start).count());
+        }
+        sort(vTimes.begin(),vTimes.end());
+        cout << "Layer " << nLayer << ": " << vIn.size() << " steps, " << nRepeat << " runs" << endl;
+        cout << "Time: min " << vTimes.front() << " ms, median " << vTimes[vTimes.size()/2]
+            << " ms, max " << vTimes.back() << " ms" << endl;
+        cout << "Checksum: " << hex << Checksum(v) << dec << endl;
+        algo->Report(cerr);
+    }
+    catch (std::exception& err)
+    {
+        cerr << err.what() << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "GCodeGenerator.h"
+#include <random>
+#include <vector>
+#include <iomanip>
+#include <math.h>
+
+using namespace std;
+
+/** Writer of the synthetic g-code, keeping the current state like a slicer */
+struct GCodeGeneratorState
+{
+    ostream& os;
+    double m_X;
+    double m_Y;
+    double m_E;
+    double m_F;
+
+    GCodeGeneratorState(ostream& os_) :
+        os(os_),
+        m_X(0),
+        m_Y(0),
+        m_E(0),
+        m_F(0) {}
+
+    static double Micron(double v) { return floor(v*1000.0 + 0.5)/1000.0; }
+
+    void Speed(double f)
+    {
+        if (f != m_F)
+            os << " F" << f;
+        m_F = f;
+    }
+
+    /** Travel move, with retraction if it is long */
+    void Travel(double x,double y,double z = -1)
+    {
+        x = Micron(x);
+        y = Micron(y);
+        bool bRetract = (x-m_X)*(x-m_X) + (y-m_Y)*(y-m_Y) > 2.0*2.0;
+        if (bRetract)
+            os << "G10" << endl;
+        os << "G0";
+        Speed(5400);
+        os << " X" << x << " Y" << y;
+        if (z >= 0)
+            os << " Z" << z;
+        os << endl;
+        if (bRetract)
+            os << "G11" << endl;
+        m_X = x;
+        m_Y = y;
+    }
+
+    /** Extrusion move */
+    void Extrude(double x,double y)
+    {
+        x = Micron(x);
+        y = Micron(y);
+        double len = sqrt((x-m_X)*(x-m_X) + (y-m_Y)*(y-m_Y));
+        m_E = floor((m_E + len * 0.0333)*100000.0 + 0.5)/100000.0;
+        os << "G1";
+        Speed(1800);
+        os << " X" << x << " Y" << y << " E" << setprecision(10) << m_E << setprecision(6) << endl;
+        m_X = x;
+        m_Y = y;
+    }
+
+    /** Closed polygon starting at point n0 */
+    void Loop(const vector<pair<double,double>>& v,int n0)
+    {
+        int sz = v.size();
+        Travel(v[n0].first,v[n0].second);
+        for (int i=1;i<=sz;i++)
+            Extrude(v[(n0+i)%sz].first,v[(n0+i)%sz].second);
+    }
+};
+
+void GenerateGCode(const GCodeCorpus& corpus,ostream& os)
+{
+    const double width = 0.7; // Wall width
+    const double layerHeight = 0.2;
+    const double xMin = 80, xMax = 120, yMin = 80, yMax = 120;
+    mt19937 gen(corpus.seed);
+    GCodeGeneratorState st(os);
+
+    /*
+     * Holes on a regular grid inside the square
+     */
+    int nCols = (int)ceil(sqrt((double)corpus.circles));
+    double cell = (xMax - xMin) / (nCols ? nCols : 1);
+    double radius = min(4.0,cell * 0.2);
+    vector<pair<double,double>> vCenters;
+    for (int i=0;i<corpus.circles;i++)
+        vCenters.push_back(make_pair(xMin + cell * (i % nCols + 0.5),yMin + cell * (i / nCols + 0.5)));
+
+    os << ";FLAVOR:UltiGCode" << endl;
+    os << ";Generated with gcode_gen" << endl;
+    os << ";LAYER_COUNT:" << corpus.layers << endl;
+    for (int nLayer=0;nLayer<corpus.layers;nLayer++)
+    {
+        double z = GCodeGeneratorState::Micron(layerHeight * (nLayer + 1));
+        os << ";LAYER:" << nLayer << endl;
+        if (nLayer == 0)
+            os << "M107" << endl;
+        st.Travel(xMin + width/2.0,yMin + width/2.0,z);
+        for (int p=corpus.perimeters-1;p>=0;p--)
+        {
+            os << (p == 0 ? ";TYPE:WALL-OUTER" : ";TYPE:WALL-INNER") << endl;
+            double d = width/2.0 + p * width;
+            vector<pair<double,double>> v;
+            v.push_back(make_pair(xMin + d,yMin + d));
+            v.push_back(make_pair(xMax - d,yMin + d));
+            v.push_back(make_pair(xMax - d,yMax - d));
+            v.push_back(make_pair(xMin + d,yMax - d));
+            st.Loop(v,(nLayer + p) % 4);
+            for (auto c = vCenters.begin();c != vCenters.end();c++)
+            {
+                double r = radius + d;
+                int nSeg = max(12,(int)(2.0 * M_PI * r / 0.4));
+                vector<pair<double,double>> vc;
+                for (int i=0;i<nSeg;i++)
+                    vc.push_back(make_pair(c->first + r * cos(2.0 * M_PI * i / nSeg),
+                                c->second + r * sin(2.0 * M_PI * i / nSeg)));
+                st.Loop(vc,gen() % nSeg);
+            }
+        }
+        if (corpus.infill > 0)
+        {
+            os << ";TYPE:FILL" << endl;
+            double lo = xMin + corpus.perimeters * width + width/2.0;
+            double hi = xMax - corpus.perimeters * width - width/2.0;
+            double spacing = width * 100.0 / corpus.infill;
+            double size = hi - lo;
+            bool bForward = true;
+            for (double c=-size + spacing/2.0;c<size;c+=spacing)
+            {
+                // Diagonal x - y = c, or x + y = c for odd layers, clipped to the square [lo,hi]
+                double x1 = lo + max(0.0,c), y1 = lo + max(0.0,-c);
+                double x2 = hi + min(0.0,c), y2 = hi + min(0.0,-c);
+                if (nLayer % 2)
+                {
+                    y1 = lo + size - (y1 - lo);
+                    y2 = lo + size - (y2 - lo);
+                }
+                if (!bForward)
+                {
+                    swap(x1,x2);
+                    swap(y1,y2);
+                }
+                st.Travel(x1,y1);
+                st.Extrude(x2,y2);
+                bForward = !bForward;
+            }
+        }
+    }
+    os << "M107" << endl;
+}
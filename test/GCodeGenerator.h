@@ -0,0 +1,36 @@
+#ifndef _GCODEGENERATOR_H
+#define _GCODEGENERATOR_H
+
+/** @file */
+
+#include <ostream>
+
+/** @brief Description of a synthetic g-code file */
+struct GCodeCorpus
+{
+    int layers /** Number of layers */;
+    int perimeters /** Number of perimeters around the part and around each hole */;
+    int circles /** Number of round holes in the part */;
+    int infill /** Infill density in percent, 0 for no infill */;
+    int seed /** Seed of the pseudo-random variations */;
+
+    GCodeCorpus() :
+        layers(10),
+        perimeters(2),
+        circles(4),
+        infill(20),
+        seed(1) {}
+};
+
+/** Writes a deterministic g-code file
+ *
+ * The part is a square with round holes, each layer has the same perimeters
+ * with a varying seam position, and a diagonal infill changing direction every layer.
+ * The output only depends on the corpus description.
+ *
+ * @param corpus Description of the file
+ * @param os Output stream
+ */
+void GenerateGCode(const GCodeCorpus& corpus,std::ostream& os);
+
+#endif
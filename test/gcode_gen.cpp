@@ -0,0 +1,45 @@
+#include <boost/program_options.hpp>
+#include <iostream>
+#include "GCodeGenerator.h"
+
+using namespace std;
+
+namespace po = boost::program_options;
+
+int main(int argc,char **argv)
+{
+    GCodeCorpus corpus;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "produce help message")
+        ("layers",po::value<int>(&corpus.layers)->default_value(corpus.layers),"Number of layers")
+        ("perimeters",po::value<int>(&corpus.perimeters)->default_value(corpus.perimeters),"Number of perimeters")
+        ("circles",po::value<int>(&corpus.circles)->default_value(corpus.circles),"Number of round holes")
+        ("infill",po::value<int>(&corpus.infill)->default_value(corpus.infill),"Infill density in percent")
+        ("seed",po::value<int>(&corpus.seed)->default_value(corpus.seed),"Seed of the pseudo-random variations")
+        ;
+    try
+    {
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+        if (vm.count("help"))
+        {
+            cout << "Usage: gcode_gen [options] >file.gcode" << endl;
+            cout << desc << "\n";
+            return 0;
+        }
+        if (corpus.layers < 0 || corpus.perimeters < 1 || corpus.circles < 0 || corpus.infill < 0 || corpus.infill > 100)
+        {
+            cerr << "Invalid corpus description" << endl;
+            return -1;
+        }
+        GenerateGCode(corpus,cout);
+    }
+    catch (std::exception& err)
+    {
+        cerr << err.what() << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * Throughput regression suite
+ *
+ * Each line of the baseline file describes a synthetic corpus and its expected results:
+ *
+ *     name layers perimeters circles infill checksum MB/s layers/s
+ *
+ * The checksum is the FNV-1a hash of the output of post_stretch with the default parameters.
+ * The test fails if an output differs from its checksum, or if a throughput is below the baseline.
+ *
+ * Usage: PerfTest [--checksum-only] [--record] [--parseThreads n] [--speculativeThreads n] [--stream] [--asyncOutput] baseline.txt
+ *
+ * --checksum-only Does not check the throughput, for unoptimized builds
+ * --parseThreads Number of parsing threads, the output must not depend on it
+ * --speculativeThreads Number of threads processing windows of sequences in advance, the output must not depend on it
+ * --stream Streaming mode without window, the output must not depend on it
+ * --asyncOutput Output written to a temporary file by @ref AsyncOutput, the output must not depend on it
+ * --record Writes the baseline lines of the current build, with 40% of the measured throughput,
+ *          so that only large slowdowns fail the test
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <stdint.h>
+#include <stdlib.h>
+#include "GCodeGenerator.h"
+#include "GCodeParser.h"
+#include "StretchAlgorithm.h"
+#include "params.h"
+#include "AsyncOutput.h"
+#include <stdio.h>
+#include <stdexcept>
+
+using namespace std;
+
+/** Number of runs of each corpus, the fastest one is kept */
+static const int Repeat = 3;
+/** Part of the measured throughput recorded as baseline */
+static const double BaselineMargin = 0.4;
+
+/** FNV-1a 64 bits hash */
+static uint64_t Checksum(const string& s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (auto i = s.begin();i != s.end();i++)
+    {
+        h ^= (unsigned char)*i;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/** Processes the g-code
+ *
+ * @param input G-Code file content
+ * @param output Processed g-code
+ * @param params Parameters, the default ones except for the parsing and the streaming
+ * @param bAsyncOutput Writes the output to a temporary file with @ref AsyncOutput
+ * @return Processing time in seconds
+ */
+static double Run(const string& input,string& output,const Params& params,bool bAsyncOutput)
+{
+    istringstream is(input);
+    ostringstream os;
+    FILE *f = bAsyncOutput ? tmpfile() : NULL;
+    if (bAsyncOutput && !f)
+        throw runtime_error("Unable to create a temporary file");
+    unique_ptr<AsyncOutput> async(f ? new AsyncOutput(fileno(f)) : NULL);
+    streambuf *coutBuf = cout.rdbuf(f ? (streambuf *)async.get() : os.rdbuf());
+    // The writer changes the precision of cout, each run starts like a new process
+    streamsize precision = cout.precision(6);
+    auto start = chrono::steady_clock::now();
+    try
+    {
+        unique_ptr<StretchAlgorithm> algo(StretchAlgorithmFactory(params));
+        GCodeParser(algo.get(),is,params);
+    }
+    catch (...)
+    {
+        cout.rdbuf(coutBuf);
+        cout.precision(precision);
+        if (f)
+            fclose(f);
+        throw;
+    }
+    if (async)
+        async->Close();
+    auto stop = chrono::steady_clock::now();
+    cout.rdbuf(coutBuf);
+    cout.precision(precision);
+    if (f)
+    {
+        output.assign(ftell(f),'\0');
+        rewind(f);
+        if (fread(&output[0],1,output.size(),f) != output.size())
+            output.clear();
+        fclose(f);
+    }
+    else
+        output = os.str();
+    return chrono::duration<double>(stop - start).count();
+}
+
+int main(int argc,char **argv)
+{
+    bool bChecksumOnly = false;
+    bool bRecord = false;
+    bool bAsyncOutput = false;
+    Params params;
+    string baselineFile;
+    for (int i=1;i<argc;i++)
+    {
+        string arg(argv[i]);
+        if (arg == "--checksum-only")
+            bChecksumOnly = true;
+        else if (arg == "--record")
+            bRecord = true;
+        else if (arg == "--parseThreads" && i+1 < argc)
+            params.parseThreads = atoi(argv[++i]);
+        else if (arg == "--speculativeThreads" && i+1 < argc)
+            params.speculativeThreads = atoi(argv[++i]);
+        else if (arg == "--stream")
+        {
+            params.stream = true;
+            params.streamWindow = 0;
+        }
+        else if (arg == "--asyncOutput")
+            bAsyncOutput = true;
+        else
+            baselineFile = arg;
+    }
+    if (baselineFile.empty())
+    {
+        cerr << "Usage: PerfTest [--checksum-only] [--record] [--parseThreads n] [--speculativeThreads n] [--stream] [--asyncOutput] baseline.txt" << endl;
+        return -1;
+    }
+    ifstream isb(baselineFile.c_str());
+    if (!isb.is_open())
+    {
+        cerr << "Unable to read baseline file " << baselineFile << endl;
+        return -1;
+    }
+    int nFailures = 0;
+    string line;
+    while (getline(isb,line))
+    {
+        if (line.empty() || line[0] == '#')
+        {
+            if (bRecord)
+                cout << line << endl;
+            continue;
+        }
+        istringstream ls(line);
+        string name,checksum;
+        GCodeCorpus corpus;
+        double minMBs,minLayers;
+        if (!(ls >> name >> corpus.layers >> corpus.perimeters >> corpus.circles >> corpus.infill
+                    >> checksum >> minMBs >> minLayers))
+        {
+            cerr << "Invalid baseline line: " << line << endl;
+            return -1;
+        }
+        ostringstream gen;
+        GenerateGCode(corpus,gen);
+        string input = gen.str();
+        string output;
+        double t = 0;
+        for (int n=0;n<Repeat;n++)
+        {
+            double tn = Run(input,output,params,bAsyncOutput);
+            if (n == 0 || tn < t)
+                t = tn;
+        }
+        ostringstream ssChecksum;
+        ssChecksum << hex << setw(16) << setfill('0') << Checksum(output);
+        double MBs = input.size() / 1e6 / t;
+        double layers = corpus.layers / t;
+        if (bRecord)
+        {
+            cout << name << " " << corpus.layers << " " << corpus.perimeters << " " << corpus.circles
+                << " " << corpus.infill << " " << ssChecksum.str()
+                << " " << setprecision(3) << MBs * BaselineMargin << " " << layers * BaselineMargin << endl;
+            continue;
+        }
+        cout << name << ": " << input.size() << " bytes, " << t << " s, "
+            << MBs << " MB/s (baseline " << minMBs << "), "
+            << layers << " layers/s (baseline " << minLayers << ")" << endl;
+        if (ssChecksum.str() != checksum)
+        {
+            cout << name << ": output checksum " << ssChecksum.str() << " differs from " << checksum << endl;
+            nFailures++;
+        }
+        if (!bChecksumOnly && (MBs < minMBs || layers < minLayers))
+        {
+            cout << name << ": throughput below the baseline" << endl;
+            nFailures++;
+        }
+    }
+    return nFailures ? 1 : 0;
+}
@@ -3,6 +3,23 @@
 
 #include <cmath>
 #include "microgeo.h"
+#include "SequenceGeometry.h"
+#include "ContactEngine.h"
+#include "params.h"
+#include "ArcFitter.h"
+#include "Trace.h"
+#include "PerfCounters.h"
+#include "GCodeParser.h"
+#include "Patch.h"
+#include "LayerReuse.h"
+#include "LayerSnapshot.h"
+#include "StretchAlgorithm.h"
+#include "StepCache.h"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <vector>
+#include <cstdlib>
+#include <sstream>
 
 BOOST_AUTO_TEST_SUITE(test_suite_microgeo)
 
@@ -42,6 +59,731 @@ BOOST_AUTO_TEST_CASE(microgeo_4)
     BOOST_CHECK(yp < 200);
 }
 
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(test_suite_geometry)
+
+static double CarreDistance(const std::pair<double,double>& p1,const std::pair<double,double>& p2)
+{
+    return (p2.first-p1.first)*(p2.first-p1.first) + (p2.second-p1.second)*(p2.second-p1.second);
+}
+
+BOOST_AUTO_TEST_CASE(geometry_triangles)
+{
+    // The two-pointer sweep must find the same triangles as a point by point walk
+    const double d1 = 0.5;
+    srand(1);
+    for (int n=0;n<50;n++)
+    {
+        std::vector<std::pair<double,double>> v;
+        int sz = 3 + rand()%60;
+        double x = 100, y = 100;
+        for (int i=0;i<sz;i++)
+        {
+            x += (rand()%1000 - 500) / 1000.0;
+            y += (rand()%1000 - 500) / 1000.0;
+            v.push_back(std::make_pair(x,y));
+        }
+        for (int bClosed=0;bClosed<2;bClosed++)
+        {
+            SequenceGeometry geo(v,bClosed);
+            std::vector<int> vA,vC;
+            geo.Triangles(v,d1,vA,vC);
+            int decMax = sz/3;
+            for (int i=bClosed ? 0 : 1;i+(bClosed ? 0 : 1)<sz;i++)
+            {
+                int i1,i3;
+                if (bClosed)
+                {
+                    int dec = 1;
+                    while (CarreDistance(v[(i-dec+sz)%sz],v[i]) < d1*d1 && dec < decMax)
+                        dec++;
+                    i1 = (i-dec+sz)%sz;
+                    dec = 1;
+                    while (CarreDistance(v[i],v[(i+dec)%sz]) < d1*d1 && dec < decMax)
+                        dec++;
+                    i3 = (i+dec)%sz;
+                }
+                else
+                {
+                    i1 = i-1;
+                    while (CarreDistance(v[i1],v[i]) < d1*d1 && i1 > 0)
+                        i1--;
+                    i3 = i+1;
+                    while (CarreDistance(v[i],v[i3]) < d1*d1 && i3+1 < sz)
+                        i3++;
+                }
+                BOOST_CHECK_EQUAL(vA[i],i1);
+                BOOST_CHECK_EQUAL(vC[i],i3);
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(contact_raster)
+{
+    // Away from the boundary, the raster engine gives the same answers as the exact engine
+    Params params;
+    params.contact = CM_Raster;
+    params.rasterResolution = 25;
+    std::unique_ptr<ContactEngine> raster(ContactEngineFactory(params));
+    std::unique_ptr<ContactEngine> exact(ContactEngineFactory(params,true));
+    std::vector<std::pair<double,double>> v;
+    v.push_back(std::make_pair(10.0,10.0));
+    v.push_back(std::make_pair(20.0,10.0));
+    v.push_back(std::make_pair(20.0,15.0));
+    v.push_back(std::make_pair(12.0,11.0));
+    raster->Clear(10,10,20,15);
+    exact->Clear(10,10,20,15);
+    raster->AddSequence(v);
+    exact->AddSequence(v);
+    const double radius = 0.4;
+    const double tolerance = 0.025 * sqrt(2.0) / 2.0;
+    srand(2);
+    for (int n=0;n<10000;n++)
+    {
+        double x = 8 + (rand()%14000) / 1000.0;
+        double y = 8 + (rand()%9000) / 1000.0;
+        double d = std::min(DistanceSegmentPoint(x,y,10,10,20,10),DistanceSegmentPoint(x,y,20,10,20,15));
+        d = std::min(d,DistanceSegmentPoint(x,y,20,15,12,11));
+        if (fabs(d - radius) > tolerance)
+            BOOST_CHECK_EQUAL(raster->Touches(x,y),exact->Touches(x,y));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(contact_tiled)
+{
+    // Same answers as the exact engine away from the contact distance, with segments longer than a tile
+    Params params;
+    params.contact = CM_Tiled;
+    std::unique_ptr<ContactEngine> tiled(ContactEngineFactory(params));
+    std::unique_ptr<ContactEngine> exact(ContactEngineFactory(params,true));
+    std::vector<std::pair<double,double>> v;
+    v.push_back(std::make_pair(10.0,10.0));
+    v.push_back(std::make_pair(30.5,12.25));
+    v.push_back(std::make_pair(30.5,14.0));
+    v.push_back(std::make_pair(12.0,30.0));
+    tiled->Clear(10,10,30.5,30);
+    exact->Clear(10,10,30.5,30);
+    tiled->AddSequence(v);
+    exact->AddSequence(v);
+    srand(3);
+    for (int n=0;n<10000;n++)
+    {
+        double x = 8 + (rand()%25000) / 1000.0;
+        double y = 8 + (rand()%25000) / 1000.0;
+        // The ends of the parts of the long segments are rounded to the micron
+        double d = 1e9;
+        for (int i=0;i+1<v.size();i++)
+            d = std::min(d,DistanceSegmentPoint(x,y,v[i].first,v[i].second,v[i+1].first,v[i+1].second));
+        if (fabs(d - 0.4) > 0.001)
+            BOOST_CHECK_EQUAL(tiled->Touches(x,y),exact->Touches(x,y));
+    }
+    BOOST_CHECK(!tiled->Touches(nan(""),10));
+}
+
+BOOST_AUTO_TEST_CASE(contact_recent)
+{
+    // Only the last sequences, or the last millimeters of path, are kept
+    Params params;
+    params.contact = CM_Recent;
+    params.recentSequences = 2;
+    std::unique_ptr<ContactEngine> recent(ContactEngineFactory(params));
+    recent->Clear(0,0,100,100);
+    for (int i=0;i<3;i++)
+    {
+        std::vector<std::pair<double,double>> v;
+        v.push_back(std::make_pair(10.0,10.0 + i*10));
+        v.push_back(std::make_pair(20.0,10.0 + i*10));
+        recent->AddSequence(v);
+    }
+    BOOST_CHECK(!recent->Touches(15,10));
+    BOOST_CHECK(recent->Touches(15,20));
+    BOOST_CHECK(recent->Touches(15,30));
+
+    params.recentSequences = 0;
+    params.recentLength = 15;
+    recent = ContactEngineFactory(params);
+    recent->Clear(0,0,100,100);
+    for (int i=0;i<3;i++)
+    {
+        std::vector<std::pair<double,double>> v;
+        v.push_back(std::make_pair(10.0,10.0 + i*10));
+        v.push_back(std::make_pair(20.0,10.0 + i*10));
+        recent->AddSequence(v);
+    }
+    BOOST_CHECK(!recent->Touches(15,10));
+    BOOST_CHECK(recent->Touches(15,20));
+}
+
+BOOST_AUTO_TEST_CASE(arc_fitting)
+{
+    // A quarter of circle made of linear moves becomes a single arc
+    std::vector<GCodeStep> v;
+    GCodeStep step;
+    step.m_Step = GC_MoveFast;
+    step.m_X = 110;
+    step.m_Y = 100;
+    v.push_back(step);
+    for (int i=1;i<=40;i++)
+    {
+        double a = M_PI / 2.0 * i / 40.0;
+        step.m_Step = GC_MoveLin;
+        step.m_X = floor((100 + 10 * cos(a))*1000.0 + 0.5)/1000.0;
+        step.m_Y = floor((100 + 10 * sin(a))*1000.0 + 0.5)/1000.0;
+        step.m_E = i * 0.025;
+        v.push_back(step);
+    }
+    BOOST_CHECK_EQUAL(ArcFitting(v,0.01),39);
+    BOOST_REQUIRE_EQUAL(v.size(),2);
+    BOOST_CHECK_EQUAL(v[1].m_Step,GC_ArcCCW);
+    BOOST_CHECK_EQUAL(v[1].m_X,100);
+    BOOST_CHECK_EQUAL(v[1].m_Y,110);
+    BOOST_CHECK_CLOSE(v[1].m_E,1.0,1e-9);
+    BOOST_CHECK_SMALL(v[1].m_I + 10,0.002);
+    BOOST_CHECK_SMALL(v[1].m_J,0.002);
+}
+
+/** Processes g-code text, and returns the output */
+static std::string ProcessGCode(const std::string& text,const Params& params)
+{
+    std::unique_ptr<StretchAlgorithm> algo(StretchAlgorithmFactory(params));
+    std::istringstream is(text);
+    std::ostringstream os;
+    std::streambuf *coutBuf = std::cout.rdbuf(os.rdbuf());
+    GCodeParser(algo.get(),is,params);
+    std::cout.rdbuf(coutBuf);
+    return os.str();
+}
+
+BOOST_AUTO_TEST_CASE(arc_input)
+{
+    // The start and the end of an arc are not moved, so that its centre and its radius are kept
+    const std::string text =
+            "G0 F1800 X50 Y50 Z0.2\n"
+            "G1 X55 Y50 E1\n"
+            "G1 X60 Y50 E2\n"
+            "G3 X70 Y60 I0 J10 E4\n"
+            "G1 X70 Y65 E5\n"
+            "G1 X65 Y70 E6\n"
+            "G0 X10 Y10 Z0.4\n";
+    Params params;
+    std::string output = ProcessGCode(text,params);
+    BOOST_CHECK(output.find("G1 X60 Y50 E2\nG3 X70 Y60 I0 J10 E4\n") != std::string::npos);
+    // The corner after the arc is still corrected
+    BOOST_CHECK(output.find("G1 X70 Y65 E5\n") == std::string::npos);
+    params.stream = true;
+    BOOST_CHECK_EQUAL(ProcessGCode(text,params),output);
+}
+
+BOOST_AUTO_TEST_CASE(microgeo_douglas_peucker)
+{
+    // All the points removed are within the tolerance of the simplified polyline
+    std::vector<std::pair<double,double>> v,vOut;
+    for (int i=0;i<200;i++)
+        v.push_back(std::make_pair(100 + 20 * cos(i / 100.0),100 + 20 * sin(i / 100.0)));
+    const double tolerance = 0.02;
+    DouglasPeucker(v,tolerance,vOut);
+    BOOST_CHECK(vOut.size() < v.size() / 4);
+    BOOST_CHECK(vOut.front() == v.front());
+    BOOST_CHECK(vOut.back() == v.back());
+    for (int i=0;i<v.size();i++)
+    {
+        double d = 1e9;
+        for (int j=0;j+1<vOut.size();j++)
+            d = std::min(d,DistanceSegmentPoint(v[i].first,v[i].second,
+                        vOut[j].first,vOut[j].second,vOut[j+1].first,vOut[j+1].second));
+        BOOST_CHECK(d <= tolerance);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(trace_write)
+{
+    TraceStart();
+    {
+        TraceSpan span("Process",12,3);
+        TraceSpan none(NULL,5,3);
+    }
+    std::ostringstream os;
+    TraceWrite(os);
+    std::string s = os.str();
+    BOOST_CHECK(s.find("\"traceEvents\"") != std::string::npos);
+    BOOST_CHECK(s.find("\"name\":\"Process\",\"ph\":\"X\"") != std::string::npos);
+    BOOST_CHECK(s.find("\"args\":{\"steps\":12,\"layer\":3}") != std::string::npos);
+    BOOST_CHECK_EQUAL(s.find("\"steps\":5"),std::string::npos);
+    // The following tests must not record spans
+    TraceStop();
+    BOOST_CHECK(!TraceEnabled());
+    {
+        TraceSpan span("Process",7,3);
+    }
+    std::ostringstream os2;
+    TraceWrite(os2);
+    BOOST_CHECK_EQUAL(os2.str().find("\"steps\":7"),std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(perf_counters)
+{
+    // Without hardware counters, only the times are written
+    PerfCountersStart();
+    {
+        PerfCounterScope parse(PS_Parse,10,2);
+        PerfCounterScope pushWall(PS_PushWall,4,2);
+    }
+    std::ostringstream os;
+    PerfCountersWrite(os);
+    std::string s = os.str();
+    BOOST_CHECK_EQUAL(s.find("layer\tstage\tcalls\tvertices\ttime_ms"),0);
+    BOOST_CHECK(s.find("\n2\tParse\t1\t10\t") != std::string::npos);
+    BOOST_CHECK(s.find("\n2\tPushWall\t1\t4\t") != std::string::npos);
+    BOOST_CHECK_EQUAL(s.find("WideTurn"),std::string::npos);
+    // The following tests must not record their stages
+    PerfCountersStop();
+    BOOST_CHECK(!PerfCountersEnabled());
+    {
+        PerfCounterScope wideTurn(PS_WideTurn,3,2);
+    }
+    std::ostringstream os2;
+    PerfCountersWrite(os2);
+    BOOST_CHECK_EQUAL(os2.str(),s);
+}
+
+BOOST_AUTO_TEST_CASE(layer_index)
+{
+    // Layers are runs of steps with the same Z, the header being the first one
+    std::istringstream is(
+            ";header\n"
+            "G0 F1800 X10 Y10 Z0.2\n"
+            "G1 X20 Y10 E1\r\n"
+            "M106 S255\n"
+            "G0 X10 Y20 Z0.4\n"
+            "G1 X20 E2\n");
+    std::vector<GCodeLayerIndex> v;
+    GCodeIndex(is,v);
+    BOOST_REQUIRE_EQUAL(v.size(),3);
+    BOOST_CHECK_EQUAL(v[0].m_Offset,0);
+    BOOST_CHECK_EQUAL(v[0].m_nSteps,1);
+    BOOST_CHECK_EQUAL(v[1].m_Offset,8);
+    BOOST_CHECK_EQUAL(v[1].m_nLine,2);
+    BOOST_CHECK_EQUAL(v[1].m_nSteps,3);
+    BOOST_CHECK_EQUAL(v[2].m_Offset,55);
+    BOOST_CHECK_EQUAL(v[2].m_nLine,5);
+    BOOST_CHECK_EQUAL(v[2].m_State.m_X,20);
+    BOOST_CHECK_EQUAL(v[2].m_State.m_Y,10);
+    BOOST_CHECK_EQUAL(v[2].m_State.m_Z,0.2);
+    BOOST_CHECK_EQUAL(v[2].m_State.m_E,1);
+    BOOST_CHECK_EQUAL(v[2].m_State.m_F,1800);
+    BOOST_CHECK_EQUAL(v[2].m_State.m_S,255);
+}
+
+/** Processes a range of layers of g-code text, and returns the output */
+static std::string ProcessLayers(const std::string& text,int first,int last,const Params& params)
+{
+    std::unique_ptr<StretchAlgorithm> algo(StretchAlgorithmFactory(params));
+    std::istringstream isIndex(text);
+    std::vector<GCodeLayerIndex> v;
+    GCodeIndex(isIndex,v);
+    std::istringstream is(text);
+    std::ostringstream os;
+    std::streambuf *coutBuf = std::cout.rdbuf(os.rdbuf());
+    GCodeParseLayers(algo.get(),is,v,first,last,params);
+    std::cout.rdbuf(coutBuf);
+    return os.str();
+}
+
+BOOST_AUTO_TEST_CASE(layer_range)
+{
+    // The last corner of the layer is moved, the next layer relies on its original position
+    const std::string text =
+            "G0 F1800 X10 Y10 Z0.2\n"
+            "G1 X30 Y10 E1\n"
+            "G1 X30 Y30 E2\n"
+            "G1 X10 Y30 E3\n"
+            "G1 X10 Y10 E4\n"
+            "G0 X10.7 Y10.7\n"
+            "G1 X29.3 Y10.7 E5\n"
+            "G1 X29.3 Y29.3 E6\n"
+            "G1 X10.7 Y29.3 E7\n"
+            "G1 X10.7 Y10.7 E8\n"
+            "G0 Z0.4\n"
+            "G1 X20 E9\n";
+    Params params;
+    std::string output = ProcessLayers(text,1,1,params);
+    BOOST_CHECK(output.find("G1 X10.7 Y10.7 E8\n") == std::string::npos);
+    BOOST_CHECK(output.find("\nG0 X10.7 Y10.7;Position restored\n") != std::string::npos);
+    // The restored position doesn't depend on the steps kept by the layer by layer processing
+    params.stream = true;
+    BOOST_CHECK_EQUAL(ProcessLayers(text,1,1,params),output);
+}
+
+BOOST_AUTO_TEST_CASE(feature_types)
+{
+    EFeature feature = FT_None;
+    BOOST_CHECK(GCodeFeature("wall-outer",feature));
+    BOOST_CHECK_EQUAL(feature,FT_WallOuter);
+    BOOST_CHECK(GCodeFeature("SUPPORT-INTERFACE",feature));
+    BOOST_CHECK_EQUAL(feature,FT_Support);
+    BOOST_CHECK(!GCodeFeature("infill",feature));
+
+    // The type is modal, and kept in the state of the following layers
+    std::istringstream is(
+            "G0 X10 Y10 Z0.2\n"
+            ";TYPE:FILL\r\n"
+            "G1 X20 Y10 E1\n"
+            ";TYPE:PRIME-TOWER\n"
+            "G0 X10 Y20 Z0.4\n");
+    std::vector<GCodeLayerIndex> v;
+    GCodeIndex(is,v);
+    BOOST_REQUIRE_EQUAL(v.size(),2);
+    BOOST_CHECK_EQUAL(v[0].m_State.m_Feature,FT_None);
+    BOOST_CHECK_EQUAL(v[1].m_State.m_Feature,FT_Other);
+}
+/** Parses a g-code file, and returns the output */
+static std::string ParseFile(const std::string& file,StepCache& cache)
+{
+    Params params;
+    std::unique_ptr<StretchAlgorithm> algo(StretchAlgorithmFactory(params));
+    std::ifstream is(file.c_str());
+    std::ostringstream os;
+    std::streambuf *coutBuf = std::cout.rdbuf(os.rdbuf());
+    GCodeParser(algo.get(),is,params,&cache);
+    std::cout.rdbuf(coutBuf);
+    return os.str();
+}
+
+BOOST_AUTO_TEST_CASE(step_cache)
+{
+    namespace fs = boost::filesystem;
+    std::string file = (fs::temp_directory_path() / fs::unique_path("step_cache_%%%%%%.gcode")).string();
+    std::ofstream(file.c_str()) << ";TYPE:FILL\nG0 F1800 X10 Y10 Z0.2\nG1 X20 Y10 E1;end\nG1 X20 Y20 E2\n";
+    std::string output;
+    {
+        StepCache cache;
+        BOOST_CHECK(!cache.Open(file));
+        output = ParseFile(file,cache);
+        BOOST_CHECK(cache.Save());
+    }
+    StepCache cache;
+    BOOST_REQUIRE(cache.Open(file));
+    BOOST_REQUIRE_EQUAL(cache.Size(),4);
+    GCodeStep step;
+    cache.Get(2,step);
+    BOOST_CHECK_EQUAL(step.m_Step,GC_MoveLin);
+    BOOST_CHECK_EQUAL(step.m_X,20);
+    BOOST_CHECK_EQUAL(step.m_F,1800);
+    BOOST_CHECK_EQUAL(step.m_Feature,FT_Fill);
+    BOOST_CHECK_EQUAL(step.m_Comment,"end");
+    // The steps read from the cache give the same output
+    BOOST_CHECK_EQUAL(ParseFile(file,cache),output);
+
+    // A changed g-code file, of the same size, is parsed again
+    std::ofstream(file.c_str()) << ";TYPE:FILL\nG0 F1800 X10 Y10 Z0.2\nG1 X30 Y10 E1;end\nG1 X20 Y20 E2\n";
+    StepCache cache2;
+    BOOST_CHECK(!cache2.Open(file));
+    fs::remove(file);
+    fs::remove(StepCacheFile(file));
+}
+
+
+BOOST_AUTO_TEST_CASE(patch_apply)
+{
+    BOOST_CHECK_EQUAL(PatchLine("G1 X10 Y20 E1.5;comment",10250,-3),"G1 X10.25 Y-0.003 E1.5;comment");
+    BOOST_CHECK_EQUAL(PatchLine("G0 F1800 Z0.3",1000,2000),"G0 X1 Y2 F1800 Z0.3");
+
+    std::ostringstream osPatch;
+    PatchWriter writer(osPatch);
+    writer.Record(2,10.0004,20.1);
+    writer.Record(300,9.5,20.1);
+    writer.Close();
+    std::istringstream isPatch(osPatch.str());
+    PatchReader reader(isPatch);
+    long long nLine,x,y;
+    BOOST_REQUIRE(reader.Next(nLine,x,y));
+    BOOST_CHECK_EQUAL(nLine,2);
+    BOOST_CHECK_EQUAL(x,10000);
+    BOOST_CHECK_EQUAL(y,20100);
+    BOOST_REQUIRE(reader.Next(nLine,x,y));
+    BOOST_CHECK_EQUAL(nLine,300);
+    BOOST_CHECK_EQUAL(x,9500);
+    BOOST_CHECK(!reader.Next(nLine,x,y));
+
+    std::istringstream isGCode(";start\nG1 X10 Y20 E1\r\nG1 E2\n");
+    std::ostringstream os;
+    std::ostringstream osPatch2;
+    PatchWriter writer2(osPatch2);
+    writer2.Record(2,10.5,20);
+    writer2.Record(3,10,20);
+    writer2.Close();
+    std::istringstream isPatch2(osPatch2.str());
+    BOOST_CHECK_EQUAL(PatchApply(isGCode,isPatch2,os),2);
+    BOOST_CHECK_EQUAL(os.str(),";start\nG1 X10.5 Y20 E1\r\nG1 X10 Y20 E2\n");
+}
+
+BOOST_AUTO_TEST_CASE(layer_snapshot)
+{
+    Params params;
+    params.stretch = 250;
+    params.contact = CM_Tiled;
+    params.correctTypes = 1u << FT_WallOuter;
+    params.simplify = 20;
+    params.passes = PASS_WideTurn | PASS_PushWall;
+    params.recentLength = 7.5;
+    params.contactTypes = 1u << FT_Skin;
+    // How the layer is processed is not saved
+    params.islandThreads = 3;
+    params.layerBudgetMs = 12.5;
+    std::vector<GCodeStep> v(2);
+    v[0].m_Step = GC_MoveFast;
+    v[0].m_X = 10.5;
+    v[1].m_Step = GC_MoveLin;
+    v[1].m_Feature = FT_Fill;
+    v[1].m_E = 1.25;
+    v[1].m_Comment = "end";
+    std::ostringstream os;
+    LayerSnapshotWrite(os,12,params,v);
+
+    std::istringstream is(os.str());
+    int nLayer = 0;
+    Params params2;
+    std::vector<GCodeStep> v2;
+    BOOST_REQUIRE(LayerSnapshotRead(is,nLayer,params2,v2));
+    BOOST_CHECK_EQUAL(nLayer,12);
+    BOOST_CHECK_EQUAL(params2.stretch,250);
+    BOOST_CHECK_EQUAL(params2.contact,CM_Tiled);
+    BOOST_CHECK_EQUAL(params2.correctTypes,1u << FT_WallOuter);
+    BOOST_CHECK_EQUAL(params2.simplify,20);
+    BOOST_CHECK_EQUAL(params2.passes,PASS_WideTurn | PASS_PushWall);
+    BOOST_CHECK_EQUAL(params2.recentLength,7.5);
+    BOOST_CHECK_EQUAL(params2.contactTypes,1u << FT_Skin);
+    BOOST_CHECK_EQUAL(params2.islandThreads,1);
+    BOOST_CHECK_EQUAL(params2.layerBudgetMs,0);
+    BOOST_REQUIRE_EQUAL(v2.size(),2);
+    BOOST_CHECK_EQUAL(v2[0].m_X,10.5);
+    BOOST_CHECK_EQUAL(v2[1].m_Step,GC_MoveLin);
+    BOOST_CHECK_EQUAL(v2[1].m_Feature,FT_Fill);
+    BOOST_CHECK_EQUAL(v2[1].m_E,1.25);
+    BOOST_CHECK_EQUAL(v2[1].m_Comment,"end");
+
+    // The byte order is fixed: the layer number follows the magic number, little-endian
+    BOOST_CHECK_EQUAL(os.str().substr(8,4),std::string("\x0c\0\0\0",4));
+
+    // A truncated snapshot is rejected
+    std::istringstream isTruncated(os.str().substr(0,os.str().size() - 2));
+    BOOST_CHECK(!LayerSnapshotRead(isTruncated,nLayer,params2,v2));
+}
+
+BOOST_AUTO_TEST_CASE(layer_reuse)
+{
+    std::vector<GCodeStep> v(4);
+    double x[] = {10,20,20,10}, y[] = {10,10,20,20};
+    std::vector<std::pair<double,double>> vIn;
+    for (int i=0;i<4;i++)
+    {
+        v[i].m_Step = i ? GC_MoveLin : GC_MoveFast;
+        v[i].m_X = x[i];
+        v[i].m_Y = y[i];
+        v[i].m_E = i;
+        vIn.push_back(std::make_pair(x[i],y[i]));
+    }
+    std::vector<GCodeStep> vProcessed(v);
+    vProcessed[2].m_X = 20.1;
+    LayerReuse reuse(2);
+    reuse.Record(vIn,vProcessed);
+
+    std::vector<std::pair<double,double>> vOut;
+    BOOST_REQUIRE(reuse.Find(v,vOut));
+    BOOST_CHECK_EQUAL(vOut[2].first,20.1);
+
+    // A translated layer is not replayed, its processing may differ
+    std::vector<GCodeStep> vt(v);
+    for (int i=0;i<4;i++)
+        vt[i].m_X += 5;
+    BOOST_CHECK(!reuse.Find(vt,vOut));
+
+    // A different extrusion pattern starts other sequences
+    std::vector<GCodeStep> ve(v);
+    ve[2].m_E = ve[1].m_E;
+    BOOST_CHECK(!reuse.Find(ve,vOut));
+}
+
+/** Adds a square perimeter, starting with a fast move to its first corner */
+static void AddSquare(std::vector<GCodeStep>& v,double x,double y,double size)
+{
+    double dx[] = {0,1,1,0,0}, dy[] = {0,0,1,1,0};
+    double e = v.empty() ? 0 : v.back().m_E;
+    for (int i=0;i<5;i++)
+    {
+        GCodeStep step;
+        step.m_Step = i ? GC_MoveLin : GC_MoveFast;
+        step.m_X = x + dx[i] * size;
+        step.m_Y = y + dy[i] * size;
+        step.m_Z = 0.2;
+        step.m_E = e + i;
+        v.push_back(step);
+    }
+}
+
+/** Adds three nested square perimeters touching each other
+ *
+ * @param bOpen The inner perimeter is cut short, as an open path along the others
+ */
+static void AddNestedSquares(std::vector<GCodeStep>& v,double x,double y,bool bOpen = false)
+{
+    AddSquare(v,x,y,20);
+    AddSquare(v,x + 0.7,y + 0.7,18.6);
+    AddSquare(v,x + 1.4,y + 1.4,17.2);
+    if (bOpen)
+    {
+        v.pop_back();
+        v.pop_back();
+    }
+}
+
+/** Processes a layer with two sets of parameters, and checks that the positions are the same */
+static void CheckSameProcessing(const std::vector<GCodeStep>& v,const Params& params1,const Params& params2)
+{
+    std::vector<GCodeStep> v1(v), v2(v);
+    StretchAlgorithmFactory(params1)->Process(1,v1);
+    StretchAlgorithmFactory(params2)->Process(1,v2);
+    for (size_t i=0;i<v.size();i++)
+    {
+        BOOST_CHECK_EQUAL(v2[i].m_X,v1[i].m_X);
+        BOOST_CHECK_EQUAL(v2[i].m_Y,v1[i].m_Y);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(islands)
+{
+    // Two groups of nested perimeters, and a part far from them
+    std::vector<GCodeStep> v;
+    AddNestedSquares(v,10,10);
+    AddNestedSquares(v,100,100);
+    AddSquare(v,60,10,5);
+    Params params;
+    const std::vector<GCodeStep> vIn(v);
+    std::vector<GCodeStep> vSerial(v);
+    StretchAlgorithmFactory(params)->Process(1,vSerial);
+    params.islandThreads = 3;
+    std::unique_ptr<StretchAlgorithm> algo(StretchAlgorithmFactory(params));
+    algo->Process(1,v);
+    std::ostringstream os;
+    algo->Report(os);
+    BOOST_CHECK(os.str().find("1 layers split in 3 islands") != std::string::npos);
+    bool bMoved = false;
+    for (int i=0;i<v.size();i++)
+    {
+        BOOST_CHECK_EQUAL(v[i].m_X,vSerial[i].m_X);
+        BOOST_CHECK_EQUAL(v[i].m_Y,vSerial[i].m_Y);
+        bMoved |= v[i].m_X != vIn[i].m_X || v[i].m_Y != vIn[i].m_Y;
+    }
+    BOOST_CHECK(bMoved);
+}
+
+BOOST_AUTO_TEST_CASE(feature_type_policies)
+{
+    // An outer wall, and an infill perimeter touching it
+    std::vector<GCodeStep> v;
+    AddSquare(v,10,10,20);
+    AddSquare(v,10.7,10.7,18.6);
+    for (int i=0;i<v.size();i++)
+        v[i].m_Feature = i < 5 ? FT_WallOuter : FT_Fill;
+    Params params;
+    std::vector<GCodeStep> vAll(v);
+    StretchAlgorithmFactory(params)->Process(1,vAll);
+    // The infill processed alone, without the wall
+    std::vector<GCodeStep> vAlone(v.begin() + 5,v.end());
+    StretchAlgorithmFactory(params)->Process(1,vAlone);
+    bool bTouches = false;
+    for (int i=5;i<v.size();i++)
+        bTouches |= vAll[i].m_X != vAlone[i-5].m_X || vAll[i].m_Y != vAlone[i-5].m_Y;
+    BOOST_REQUIRE(bTouches);
+
+    // The infill is not corrected, the wall is corrected as before
+    params.correctTypes = ~(1u << FT_Fill);
+    std::vector<GCodeStep> vCorrect(v);
+    StretchAlgorithmFactory(params)->Process(1,vCorrect);
+    for (int i=0;i<v.size();i++)
+    {
+        const GCodeStep& expected = i < 5 ? vAll[i] : v[i];
+        BOOST_CHECK(vCorrect[i].m_X == expected.m_X && vCorrect[i].m_Y == expected.m_Y);
+    }
+
+    // The wall is not seen by PushWall: the infill is corrected as if it was alone
+    params.correctTypes = ~0u;
+    params.contactTypes = ~(1u << FT_WallOuter);
+    std::vector<GCodeStep> vContact(v);
+    StretchAlgorithmFactory(params)->Process(1,vContact);
+    for (int i=0;i<v.size();i++)
+    {
+        const GCodeStep& expected = i < 5 ? vAll[i] : vAlone[i-5];
+        BOOST_CHECK(vContact[i].m_X == expected.m_X && vContact[i].m_Y == expected.m_Y);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(fused_passes)
+{
+    // Closed perimeters, and an open path along them
+    std::vector<GCodeStep> v;
+    AddNestedSquares(v,10,10,true);
+    for (unsigned passes=0;passes<=PASS_All;passes++)
+    {
+        Params params;
+        params.passes = passes;
+        Params paramsFused(params);
+        paramsFused.fusedPasses = true;
+        CheckSameProcessing(v,params,paramsFused);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(layer_budget)
+{
+    std::vector<GCodeStep> v;
+    AddNestedSquares(v,10,10);
+    Params params;
+    // The first sequence gives the projection, any budget is exceeded by the next ones
+    params.layerBudgetMs = 1e-6;
+    std::unique_ptr<StretchAlgorithm> algo(StretchAlgorithmFactory(params));
+    std::vector<GCodeStep> vCorners(v);
+    algo->Process(1,v);
+    std::ostringstream os;
+    algo->Report(os);
+    BOOST_CHECK(os.str().find("1 layers over 1e-06 ms, 2 sequences without PushWall") != std::string::npos);
+    BOOST_CHECK(v[0].m_Comment.empty());
+    BOOST_CHECK(v[5].m_Comment.find("Layer budget exceeded") == 0);
+    // The next sequences are processed by the corner passes only
+    Params paramsCorners;
+    paramsCorners.passes = PASS_WideTurn | PASS_WideCircle;
+    StretchAlgorithmFactory(paramsCorners)->Process(1,vCorners);
+    for (int i=5;i<v.size();i++)
+        BOOST_CHECK(v[i].m_X == vCorners[i].m_X && v[i].m_Y == vCorners[i].m_Y);
+}
+
+BOOST_AUTO_TEST_CASE(layer_budget_skipped)
+{
+    // Infill sequences, neither corrected nor recorded, then two walls
+    std::vector<GCodeStep> v;
+    for (int n=0;n<100;n++)
+        AddSquare(v,10 + (n%10),10 + (n/10)*0.5,0.4);
+    size_t nFill = v.size();
+    AddSquare(v,10,120,20);
+    AddSquare(v,10.7,120.7,18.6);
+    for (int i=0;i<v.size();i++)
+        v[i].m_Feature = i < nFill ? FT_Fill : FT_WallOuter;
+    Params params;
+    params.correctTypes = params.contactTypes = ~(1u << FT_Fill);
+    std::vector<GCodeStep> vFree(v);
+    StretchAlgorithmFactory(params)->Process(1,vFree);
+    // Only the steps of the walls are projected, and they are all processed
+    params.layerBudgetMs = 1e9;
+    std::unique_ptr<StretchAlgorithm> algo(StretchAlgorithmFactory(params));
+    algo->Process(1,v);
+    std::ostringstream os;
+    algo->Report(os);
+    BOOST_CHECK(os.str().find("0 layers over 1e+09 ms, 0 sequences without PushWall, 10 of 10 projected steps processed") != std::string::npos);
+    for (int i=nFill;i<v.size();i++)
+        BOOST_CHECK(v[i].m_X == vFree[i].m_X && v[i].m_Y == vFree[i].m_Y);
+}
+
 /*
 BOOST_AUTO_TEST_CASE(test_segment)
 {